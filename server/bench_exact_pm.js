@@ -0,0 +1,345 @@
+// server/bench_exact_pm.js
+// Scaling benchmark for the exact_pm_4 binary: runs both parties over a grid of
+// text size x pattern size x threads x num-simd x input mode x match mode and writes CSV + JSON.
+// Every run reveals the match positions (--result-mode positions); a grid point fails unless each
+// party found exactly the windows equal to the pattern (the planted ones and any the text holds).
+//
+//   node bench_exact_pm.js --text-sizes 1024,1048576 --pattern-sizes 4,32 --threads 1,4
+//
+// A small grid doubles as the end-to-end match check of both pipelines:
+//
+//   node bench_exact_pm.js --text-sizes 256 --pattern-sizes 4,16,32 --modes hash,rolling
+//
+// Loopback (default) spawns both parties here. For two hosts, start the driver on each host with
+// the same grid and --seed and --party 0 / --party 1; inputs are derived from the seed, so both
+// sides agree on sizes and planted match positions. With --shm, loopback parties talk through a
+// shared-memory segment instead of TCP, so the timings leave out the kernel network stack.
+import { spawn } from "child_process";
+import path from "path";
+import fs from "fs";
+import os from "os";
+
+const DEFAULTS = {
+  bin: process.env.EXACT_PM_BIN || "./exact_pm_4",
+  textSizes: [1024, 10240, 102400, 1048576, 10485760, 104857600],
+  patternSizes: [4, 8, 16, 32, 64, 128, 256],
+  threads: [1],
+  numSimd: [1],
+  simdInputs: [false, true],
+  modes: ["hash", "rolling"],
+  hashWordBits: 64,
+  fingerprintBits: 256,
+  repetitions: 1,
+  matches: 4,
+  seed: 1,
+  party: "both",
+  hosts: ["127.0.0.1", "127.0.0.1"],
+  port: 7777,
+  shm: false,
+  timeoutSec: 3600,
+  out: "bench_results",
+};
+
+function parseList(value, parse = Number) {
+  return String(value)
+    .split(",")
+    .filter((v) => v.length > 0)
+    .map(parse);
+}
+
+function parseArgs(argv) {
+  const cfg = { ...DEFAULTS };
+  for (let i = 0; i < argv.length; i++) {
+    const arg = argv[i];
+    const next = () => {
+      if (i + 1 >= argv.length) throw new Error(`${arg} needs a value`);
+      return argv[++i];
+    };
+    switch (arg) {
+      case "--bin": cfg.bin = next(); break;
+      case "--text-sizes": cfg.textSizes = parseList(next()); break;
+      case "--pattern-sizes": cfg.patternSizes = parseList(next()); break;
+      case "--threads": cfg.threads = parseList(next()); break;
+      case "--num-simd": cfg.numSimd = parseList(next()); break;
+      case "--simd-inputs": {
+        const mode = next();
+        cfg.simdInputs = mode === "both" ? [false, true] : [mode === "on"];
+        break;
+      }
+      case "--modes": cfg.modes = parseList(next(), String); break;
+      case "--hash-word-bits": cfg.hashWordBits = Number(next()); break;
+      case "--fingerprint-bits": cfg.fingerprintBits = Number(next()); break;
+      case "--repetitions": cfg.repetitions = Number(next()); break;
+      case "--matches": cfg.matches = Number(next()); break;
+      case "--seed": cfg.seed = Number(next()); break;
+      case "--party": cfg.party = next(); break;
+      case "--hosts": cfg.hosts = parseList(next(), String); break;
+      case "--port": cfg.port = Number(next()); break;
+      case "--shm": cfg.shm = true; break;
+      case "--timeout": cfg.timeoutSec = Number(next()); break;
+      case "--out": cfg.out = next(); break;
+      case "--help":
+      case "-h":
+        console.log(
+          "usage: node bench_exact_pm.js [--bin PATH] [--text-sizes N,..] [--pattern-sizes M,..]\n" +
+            "  [--threads T,..] [--num-simd S,..] [--simd-inputs on|off|both] [--modes hash,rolling]\n" +
+            "  [--hash-word-bits B] [--fingerprint-bits F] [--repetitions R] [--matches K] [--seed X]\n" +
+            "  [--party both|0|1] [--hosts H0,H1] [--port P] [--shm] [--timeout SEC] [--out DIR]"
+        );
+        process.exit(0);
+      default:
+        throw new Error(`unknown argument ${arg}`);
+    }
+  }
+  if (cfg.hosts.length !== 2) throw new Error("--hosts needs two hosts");
+  if (cfg.shm && cfg.party !== "both") throw new Error("--shm needs both parties on this host");
+  return cfg;
+}
+
+// Small seeded PRNG (mulberry32), so both hosts of a two-host run generate the same inputs
+function makeRng(seed) {
+  let a = seed >>> 0;
+  return () => {
+    a = (a + 0x6d2b79f5) >>> 0;
+    let t = a;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+// Lowercase letters only, so the planted pattern is the only structure in the text
+function randomLetters(rng, length) {
+  const buf = Buffer.allocUnsafe(length);
+  for (let i = 0; i < length; i++) buf[i] = 97 + Math.floor(rng() * 26);
+  return buf;
+}
+
+// Every window of `text` equal to `pattern`: the planted positions plus any the random text holds
+function occurrences(text, pattern) {
+  const found = [];
+  for (let pos = text.indexOf(pattern); pos !== -1; pos = text.indexOf(pattern, pos + 1)) found.push(pos);
+  return found;
+}
+
+// Random text with the pattern planted at `matches` random positions (possibly overlapping)
+function generateInputs(seed, textSize, patternSize, matches) {
+  const rng = makeRng(seed ^ (textSize * 31 + patternSize));
+  const pattern = randomLetters(rng, patternSize);
+  const text = randomLetters(rng, textSize);
+  const positions = [];
+  for (let k = 0; k < matches; k++) {
+    const pos = Math.floor(rng() * (textSize - patternSize + 1));
+    pattern.copy(text, pos);
+    positions.push(pos);
+  }
+  return {
+    pattern,
+    text,
+    positions: [...new Set(positions)].sort((a, b) => a - b),
+    expected: occurrences(text, pattern),
+  };
+}
+
+// Per-party input file, memory-mapped by the binary (the inputs are too large for argv)
+// Returns the role-specific input arguments
+function writePartyInput(dir, partyId, inputs) {
+  const file = path.join(dir, `party${partyId}.input`);
+  if (partyId === 0) {
+    fs.writeFileSync(file, inputs.pattern);
+    return ["--pattern-file", file, "--text-size", String(inputs.text.length)];
+  }
+  fs.writeFileSync(file, inputs.text);
+  return ["--text-file", file, "--pattern-size", String(inputs.pattern.length)];
+}
+
+function partyArgs(cfg, point, partyId, inputArgs, noRun) {
+  const shm = `shm:/exact_pm_bench_${process.pid}`;
+  const args = [
+    "--my-id", String(partyId),
+    "--party", cfg.shm ? `0,${shm}` : `0,${cfg.hosts[0]},${cfg.port}`,
+    "--party", cfg.shm ? `1,${shm}` : `1,${cfg.hosts[1]},${cfg.port + 1}`,
+    "--role", partyId === 0 ? "pattern_holder" : "text_holder",
+    ...inputArgs,
+    "--threads", String(point.threads),
+    "--num-simd", String(point.numSimd),
+    "--mode", point.mode,
+    "--hash-word-bits", String(cfg.hashWordBits),
+    "--fingerprint-bits", String(cfg.fingerprintBits),
+    "--repetitions", String(cfg.repetitions),
+    "--result-mode", "positions",
+    "--json",
+  ];
+  if (point.simdInputs) args.push("--simd-inputs");
+  if (noRun) args.push("--no-run");
+  return args;
+}
+
+// Run one party to completion; resolves with its stats JSON (the last line holding "stages") and
+// its result lines (one per chunk, see --result-mode)
+function runParty(cfg, args) {
+  return new Promise((resolve, reject) => {
+    const child = spawn(cfg.bin, args, { stdio: ["ignore", "pipe", "pipe"] });
+    let stdout = "";
+    let stderr = "";
+    const timer = setTimeout(() => child.kill("SIGKILL"), cfg.timeoutSec * 1000);
+    child.stdout.on("data", (d) => (stdout += d));
+    child.stderr.on("data", (d) => (stderr += d));
+    child.on("error", (e) => {
+      clearTimeout(timer);
+      reject(e);
+    });
+    child.on("close", (code, signal) => {
+      clearTimeout(timer);
+      if (code !== 0) {
+        return reject(new Error(`exit ${code ?? signal}: ${stderr.trim().split("\n").pop()}`));
+      }
+      const lines = stdout.split("\n").filter((l) => l.startsWith("{"));
+      const line = lines.reverse().find((l) => l.includes('"stages"'));
+      if (!line) return reject(new Error("no stats JSON in output"));
+      const results = lines.filter((l) => l.includes('"results"')).map((l) => JSON.parse(l));
+      resolve({ stats: JSON.parse(line), results });
+    });
+  });
+}
+
+function samePositions(a, b) {
+  return a.length === b.length && a.every((p, i) => p === b[i]);
+}
+
+// Match positions a party revealed for its single pattern, over all chunks; every repetition
+// prints its own result lines, and all of them have to agree
+function foundPositions(results) {
+  const byChunk = new Map();
+  for (const r of results) {
+    const positions = r.results[0];
+    const earlier = byChunk.get(r.window_offset);
+    if (earlier && !samePositions(earlier, positions)) {
+      throw new Error(`repetitions disagree on the chunk at window ${r.window_offset}`);
+    }
+    byChunk.set(r.window_offset, positions);
+  }
+  return [...byChunk.values()].flat().sort((a, b) => a - b);
+}
+
+// A run fails its grid point unless every party found exactly the windows equal to the pattern
+async function runPoint(cfg, point, noRun) {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), "exact_pm_bench_"));
+  try {
+    const inputs = generateInputs(cfg.seed, point.textSize, point.patternSize, cfg.matches);
+    const parties = cfg.party === "both" ? [0, 1] : [Number(cfg.party)];
+    const runs = await Promise.all(
+      parties.map((id) => runParty(cfg, partyArgs(cfg, point, id, writePartyInput(dir, id, inputs), noRun)))
+    );
+    const found = runs.map((run) => foundPositions(run.results));
+    if (!noRun) {
+      for (let i = 0; i < runs.length; i++) {
+        if (!samePositions(found[i], inputs.expected)) {
+          throw new Error(`party ${parties[i]} found positions [${found[i].slice(0, 16)}] ` +
+            `(${found[i].length}), expected [${inputs.expected.slice(0, 16)}] (${inputs.expected.length})`);
+        }
+      }
+    }
+    return { stats: runs.map((run) => run.stats), positions: inputs.positions, expected: inputs.expected };
+  } finally {
+    fs.rmSync(dir, { recursive: true, force: true });
+  }
+}
+
+function stageMean(stats, name) {
+  return stats.stages?.[name]?.mean_ms ?? 0;
+}
+
+// One result row per party and grid point, bytes as seen by that party per repetition
+function summarize(point, buildStats, runStats, positions, expected) {
+  const numWindows = point.textSize - point.patternSize + 1;
+  const stages = Object.keys(runStats.stages || {});
+  const online = stages.filter((s) => s.startsWith("online_")).reduce((t, s) => t + stageMean(runStats, s), 0);
+  const communication = runStats.modeled_communication || {};
+  const reps = runStats.repetitions || 1;
+  const bytesSent = (communication.measured_bytes_sent ?? 0) / reps;
+  const bytesReceived = (communication.measured_bytes_received ?? 0) / reps;
+  return {
+    party_id: runStats.party_id,
+    text_size: point.textSize,
+    pattern_size: point.patternSize,
+    threads: point.threads,
+    num_simd: point.numSimd,
+    simd_inputs: point.simdInputs,
+    mode: point.mode,
+    num_windows: numWindows,
+    planted_matches: positions.length,
+    expected_matches: expected.length,
+    build_ms:
+      stageMean(buildStats, "build_input_sharing") +
+      stageMean(buildStats, "build_hash_sharing") +
+      stageMean(buildStats, "build_ham_dpf"),
+    local_hash_ms: stageMean(runStats, "local_difference_hash"),
+    online_ms: online,
+    wall_ms: stageMean(runStats, "wall"),
+    bytes_sent: bytesSent,
+    bytes_received: bytesReceived,
+    bytes_per_window: (bytesSent + bytesReceived) / numWindows,
+    modeled_online_rounds: communication.online_rounds ?? null,
+    peak_rss_kib: runStats.peak_rss_kib,
+  };
+}
+
+function toCsv(rows) {
+  if (rows.length === 0) return "";
+  const keys = Object.keys(rows[0]);
+  const lines = rows.map((r) => keys.map((k) => (r[k] === null || r[k] === undefined ? "" : r[k])).join(","));
+  return [keys.join(","), ...lines].join("\n") + "\n";
+}
+
+async function main() {
+  const cfg = parseArgs(process.argv.slice(2));
+  const points = [];
+  for (const textSize of cfg.textSizes)
+    for (const patternSize of cfg.patternSizes)
+      for (const threads of cfg.threads)
+        for (const numSimd of cfg.numSimd)
+          for (const simdInputs of cfg.simdInputs)
+            for (const mode of cfg.modes)
+              if (patternSize < textSize) points.push({ textSize, patternSize, threads, numSimd, simdInputs, mode });
+
+  fs.mkdirSync(cfg.out, { recursive: true });
+  const stamp = new Date().toISOString().replace(/[:.]/g, "-");
+  const base = path.join(cfg.out, `exact_pm_${stamp}`);
+  const rows = [];
+  const raw = [];
+
+  for (const point of points) {
+    const label = `n=${point.textSize} m=${point.patternSize} t=${point.threads} simd=${point.numSimd} ` +
+      `simd_inputs=${point.simdInputs} mode=${point.mode}`;
+    try {
+      const build = await runPoint(cfg, point, true);
+      const run = await runPoint(cfg, point, false);
+      for (let i = 0; i < run.stats.length; i++) {
+        rows.push(summarize(point, build.stats[i], run.stats[i], run.positions, run.expected));
+      }
+      raw.push({
+        point,
+        build: build.stats,
+        run: run.stats,
+        planted_positions: run.positions,
+        expected_positions: run.expected,
+      });
+      const r = rows[rows.length - run.stats.length];
+      console.log(`${label}: build ${r.build_ms.toFixed(1)} ms, online ${r.online_ms.toFixed(1)} ms, ` +
+        `${r.bytes_per_window.toFixed(1)} B/window`);
+    } catch (e) {
+      console.error(`${label}: FAILED (${e.message})`);
+      raw.push({ point, error: e.message });
+    }
+    // Write after every point, so a long grid keeps its partial results
+    fs.writeFileSync(`${base}.csv`, toCsv(rows));
+    fs.writeFileSync(`${base}.json`, JSON.stringify({ config: cfg, results: raw }, null, 2));
+  }
+  console.log(`Results: ${base}.csv, ${base}.json`);
+}
+
+main().catch((e) => {
+  console.error(e.message);
+  process.exit(1);
+});
@@ -0,0 +1,106 @@
+// server/gcm_storage.js
+// multer storage engine that decrypts an AES-256-GCM file part while it streams in. The plaintext
+// goes chunk by chunk (with backpressure) to a temporary file next to its destination and is only
+// renamed into place once the GCM tag has verified, so memory per upload stays bounded by the
+// stream buffers and a forged upload never becomes visible.
+//
+// The key material comes from the form fields, so they have to precede the file part in the
+// multipart body (multer fills req.body in body order).
+import crypto from "crypto";
+import fs from "fs";
+import path from "path";
+import { Transform } from "stream";
+import { pipeline } from "stream/promises";
+
+export class UploadError extends Error {
+  constructor(status, message) {
+    super(message);
+    this.status = status;
+  }
+}
+
+// Set by Node on the errors it reports for a GCM tag that does not verify; OpenSSL's failure in
+// decipher.final() comes without a code, so verifyingDecipher marks that one itself
+const TAG_ERROR_CODES = new Set(["ERR_CRYPTO_INVALID_AUTH_TAG"]);
+
+export class AuthTagError extends Error {}
+
+// decipher as a stream step; an error thrown by final() at the end of the input is the tag check
+// failing and rejects the pipeline as an AuthTagError
+function verifyingDecipher(decipher) {
+  return new Transform({
+    transform(chunk, _encoding, cb) {
+      let plain;
+      try {
+        plain = decipher.update(chunk);
+      } catch (e) {
+        cb(e);
+        return;
+      }
+      cb(null, plain);
+    },
+    flush(cb) {
+      let rest;
+      try {
+        rest = decipher.final();
+      } catch (e) {
+        cb(new AuthTagError(e.message, { cause: e }));
+        return;
+      }
+      cb(null, rest);
+    },
+  });
+}
+
+function isTagFailure(e) {
+  return e instanceof AuthTagError || TAG_ERROR_CODES.has(e?.code);
+}
+
+class DecryptingStorage {
+  // resolveKey(req, file) -> Promise<{ key32, iv, tag, destination }>; throw UploadError to reject
+  constructor({ resolveKey }) {
+    this.resolveKey = resolveKey;
+  }
+
+  _handleFile(req, file, cb) {
+    this.store(req, file).then((info) => cb(null, info), (e) => cb(e));
+  }
+
+  _removeFile(req, file, cb) {
+    fs.promises.rm(file.path, { force: true }).then(() => cb(null), cb);
+  }
+
+  async store(req, file) {
+    let key;
+    try {
+      key = await this.resolveKey(req, file);
+    } catch (e) {
+      // Drain the part, so the rest of the body (and the response) is not stuck behind it
+      file.stream.resume();
+      throw e;
+    }
+    const { key32, iv, tag, destination } = key;
+
+    const decipher = crypto.createDecipheriv("aes-256-gcm", key32, iv);
+    decipher.setAuthTag(tag);
+    const partial = path.join(path.dirname(destination), `.${path.basename(destination)}.part`);
+
+    try {
+      await pipeline(file.stream, verifyingDecipher(decipher), fs.createWriteStream(partial, { flags: "wx" }));
+      await fs.promises.rename(partial, destination);
+    } catch (e) {
+      // Whatever failed, the partial plaintext goes; a failing cleanup must not hide the cause
+      await fs.promises.rm(partial, { force: true }).catch((rmError) => console.error(rmError));
+      if (isTagFailure(e)) {
+        throw new UploadError(400, "Authentication tag mismatch");
+      }
+      throw e;
+    }
+    const { size } = await fs.promises.stat(destination);
+    return { path: destination, size };
+  }
+}
+
+export function decryptingStorage(options) {
+  return new DecryptingStorage(options);
+}
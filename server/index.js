@@ -8,6 +8,8 @@ import fs from "fs";
 import crypto from "crypto";
 
 import { mlkemKeypair, mlkemDecapsulate } from "./pqkem.js";
+import { MpcPool } from "./mpc_pool.js";
+import { decryptingStorage, UploadError } from "./gcm_storage.js";
 
 const app = express();
 const PORT = 4000;
@@ -24,6 +26,16 @@ fs.mkdirSync(UPLOAD_DIR, { recursive: true });
 // Simple in-memory “DB”
 const files = new Map();
 
+// exact_pm text_holder workers, configured from the environment (see mpc_pool.js)
+const mpcPool = new MpcPool();
+
+// Job record as returned by the API (without the queued plaintext)
+function jobInfo(job) {
+  if (!job) return null;
+  const { text, ...info } = job;
+  return info;
+}
+
 // Store server-side ML-KEM secret keys by keyId (short-lived)
 const kemKeys = new Map(); // keyId -> { sk: Uint8Array, pk: Uint8Array, createdAt: number }
 const KEM_TTL_MS = 10 * 60 * 1000; // 10 minutes
@@ -87,13 +99,94 @@ app.get("/kem-pubkey", async (req, res) => {
  * - ivB64: base64(12 bytes)
  * - tagB64: base64(16 bytes)
  * - originalName: string
+ * - patternSize: number (optional, expected pattern length of the matching job)
  * - cipher: file (binary)  <-- AES-GCM ciphertext without tag
+ *
+ * With the MPC worker pool enabled, the plaintext is also queued as a matching job: it is piped
+ * from memory into an exact_pm service worker, see GET /jobs/:id for its state and result.
+ */
+// Queue the matching job of an upload, if the pool runs; returns the job summary of the response
+function queueJob(id, submit) {
+  if (!mpcPool.enabled) return null;
+  try {
+    const job = submit();
+    return { state: job.state, url: `http://localhost:${PORT}/jobs/${id}` };
+  } catch (e) {
+    console.error(`matching job for ${id} not queued: ${e.message}`);
+    return null;
+  }
+}
+
+/**
+ * Streaming variant of /upload-pq for large files: same fields, but the ciphertext is decrypted
+ * while it arrives and written to uploads_plain/ chunk by chunk; the file only appears there once
+ * the GCM tag has verified. The text fields must come before the cipher part in the form.
  */
+const uploadStream = multer({
+  storage: decryptingStorage({
+    resolveKey: async (req) => {
+      cleanupKemKeys();
+
+      const { keyId, kemCtB64, ivB64, tagB64, originalName } = req.body;
+      if (!keyId || !kemCtB64 || !ivB64 || !tagB64) {
+        throw new UploadError(400, "Missing fields (send them before the cipher part)");
+      }
+
+      const kemObj = kemKeys.get(keyId);
+      if (!kemObj) throw new UploadError(404, "KEM key expired/invalid");
+
+      const iv = Buffer.from(ivB64, "base64");
+      const tag = Buffer.from(tagB64, "base64");
+      if (iv.length !== 12) throw new UploadError(400, "IV must be 12 bytes");
+      if (tag.length !== 16) throw new UploadError(400, "Tag must be 16 bytes");
+
+      // one-time use keyId, taken before the (slow) body arrives
+      kemKeys.delete(keyId);
+      const sharedSecret = await mlkemDecapsulate(new Uint8Array(Buffer.from(kemCtB64, "base64")), kemObj.sk);
+
+      req.uploadId = uuid();
+      req.safeOriginal = safeName(originalName);
+      req.storedName = `${req.uploadId}__${req.safeOriginal}`;
+      return { key32: hkdfAesKey(sharedSecret), iv, tag, destination: path.join(UPLOAD_DIR, req.storedName) };
+    },
+  }),
+}).single("cipher");
+
+app.post("/upload-pq-stream", (req, res) => {
+  uploadStream(req, res, (err) => {
+    if (err) {
+      if (!(err instanceof UploadError)) console.error(err);
+      return res.status(err.status || 500).json({ error: err.status ? err.message : "Decrypt/upload failed" });
+    }
+    if (!req.file) return res.status(400).json({ error: "Missing fields" });
+
+    const id = req.uploadId;
+    files.set(id, {
+      id,
+      originalName: req.safeOriginal,
+      storedName: req.storedName,
+      size: req.file.size,
+      uploadedAt: new Date().toISOString(),
+    });
+
+    const patternSize = req.body.patternSize ? Number(req.body.patternSize) : undefined;
+    const job = queueJob(id, () => mpcPool.submitFile(id, req.file.path, req.file.size, patternSize));
+
+    res.json({
+      id,
+      name: req.safeOriginal,
+      size: req.file.size,
+      downloadUrl: `http://localhost:${PORT}/files/${id}`,
+      job,
+    });
+  });
+});
+
 app.post("/upload-pq", uploadMem.single("cipher"), async (req, res) => {
   try {
     cleanupKemKeys();
 
-    const { keyId, kemCtB64, ivB64, tagB64, originalName } = req.body;
+    const { keyId, kemCtB64, ivB64, tagB64, originalName, patternSize } = req.body;
     if (!keyId || !kemCtB64 || !ivB64 || !tagB64 || !req.file?.buffer) {
       return res.status(400).json({ error: "Missing fields" });
     }
@@ -136,11 +229,14 @@ app.post("/upload-pq", uploadMem.single("cipher"), async (req, res) => {
     // one-time use keyId (recommended)
     kemKeys.delete(keyId);
 
+    const job = queueJob(id, () => mpcPool.submit(id, plaintext, patternSize ? Number(patternSize) : undefined));
+
     res.json({
       id,
       name: safeOriginal,
       size: plaintext.length,
       downloadUrl: `http://localhost:${PORT}/files/${id}`,
+      job,
     });
   } catch (e) {
     console.error(e);
@@ -164,4 +260,20 @@ app.get("/files/:id", (req, res) => {
   res.download(filePath, meta.originalName);
 });
 
+// Matching jobs: all, or one by upload id
+app.get("/jobs", (req, res) => {
+  res.json(Array.from(mpcPool.jobs.values(), jobInfo));
+});
+
+app.get("/jobs/:id", (req, res) => {
+  const job = mpcPool.jobs.get(req.params.id);
+  if (!job) return res.status(404).json({ error: "Not found" });
+  res.json(jobInfo(job));
+});
+
+process.on("SIGINT", () => {
+  mpcPool.close();
+  process.exit(0);
+});
+
 app.listen(PORT, () => console.log(`Server running on http://localhost:${PORT}`));
@@ -0,0 +1,223 @@
+// server/mpc_pool.js
+// Fixed pool of long-lived exact_pm text_holder processes in --service mode. Uploaded plaintext
+// is piped into a worker's control channel (descriptor line + raw bytes, see --text-bytes), so it
+// never touches disk on its way into the MPC.
+//
+// Worker i talks to its own pattern_holder peer on MPC_PEER_HOST, ports base + 2i (this side) and
+// base + 2i + 1 (peer). The peer pool has to issue the same sequence of descriptors per worker.
+// A worker that exits loses that sequence (its queries in flight are gone on one side only), so by
+// default it is retired and its queued jobs go to the remaining pairs; MPC_RESTART_WORKERS=1
+// respawns it instead, which is only safe if the peer pool restarts its worker i as well.
+// Finished jobs are kept for MPC_JOB_TTL_MS and at most MPC_MAX_JOBS records in total.
+import { spawn } from "child_process";
+import readline from "readline";
+import os from "os";
+
+// One worker per core once a binary is configured (EXACT_PM_BIN), none otherwise
+export const POOL_DEFAULTS = {
+  bin: process.env.EXACT_PM_BIN || "./exact_pm_4",
+  workers: Number(process.env.MPC_WORKERS ?? (process.env.EXACT_PM_BIN ? os.cpus().length : 0)),
+  threadsPerWorker: Number(process.env.MPC_THREADS ?? 1),
+  myHost: process.env.MPC_MY_HOST || "127.0.0.1",
+  peerHost: process.env.MPC_PEER_HOST || "127.0.0.1",
+  basePort: Number(process.env.MPC_BASE_PORT ?? 7777),
+  patternSize: Number(process.env.MPC_PATTERN_SIZE ?? 0),
+  numPatterns: Number(process.env.MPC_NUM_PATTERNS ?? 1),
+  resultMode: process.env.MPC_RESULT_MODE || "any",
+  extraArgs: (process.env.MPC_EXTRA_ARGS || "").split(" ").filter((a) => a.length > 0),
+  restartWorkers: process.env.MPC_RESTART_WORKERS === "1",
+  jobTtlMs: Number(process.env.MPC_JOB_TTL_MS ?? 60 * 60 * 1000),
+  maxJobs: Number(process.env.MPC_MAX_JOBS ?? 1000),
+};
+
+const RESTART_DELAY_MS = 1000;
+
+class MpcWorker {
+  constructor(pool, index) {
+    this.pool = pool;
+    this.index = index;
+    this.job = null;
+    this.retired = false;
+    this.start();
+  }
+
+  start() {
+    const cfg = this.pool.cfg;
+    const port = cfg.basePort + 2 * this.index;
+    const args = [
+      "--my-id", "1",
+      "--party", `0,${cfg.peerHost},${port + 1}`,
+      "--party", `1,${cfg.myHost},${port}`,
+      "--role", "text_holder",
+      "--threads", String(cfg.threadsPerWorker),
+      "--result-mode", cfg.resultMode,
+      "--service",
+      "--json",
+      ...cfg.extraArgs,
+    ];
+    this.child = spawn(cfg.bin, args, { stdio: ["pipe", "pipe", "pipe"] });
+    this.alive = true;
+    this.stderr = "";
+    this.child.stderr.on("data", (d) => (this.stderr = (this.stderr + d).slice(-4096)));
+    // A broken pipe surfaces as an exit, handled below
+    this.child.stdin.on("error", () => {});
+
+    // Per query: result lines (one per chunk for positions, one for any / count), then the stats
+    // line, or an error line if the query failed (all carry query_id)
+    readline.createInterface({ input: this.child.stdout }).on("line", (line) => {
+      if (!this.job || !line.startsWith("{")) return;
+      let obj;
+      try {
+        obj = JSON.parse(line);
+      } catch {
+        return;
+      }
+      if (obj.results) {
+        this.job.results.push(obj);
+      } else if (obj.stages) {
+        this.finish(null, obj);
+      } else if (obj.error) {
+        this.finish(new Error(obj.error), null);
+      }
+    });
+
+    const onExit = (reason) => {
+      if (!this.alive) return;
+      this.alive = false;
+      const error = new Error(`exact_pm worker ${this.index} exited (${reason}): ` +
+        this.stderr.trim().split("\n").pop());
+      if (!this.pool.closed && !this.pool.cfg.restartWorkers) {
+        // The peer's worker is still at a different point of the descriptor sequence
+        this.retired = true;
+        console.error(`${error.message}; retiring it, its peer pairing is out of sync`);
+      } else if (!this.pool.closed) {
+        console.error(error.message);
+        // Back off, so a missing binary or peer does not turn into a spawn loop
+        setTimeout(() => {
+          this.start();
+          this.pool.schedule();
+        }, RESTART_DELAY_MS);
+      }
+      if (this.job) {
+        this.finish(error, null);
+      } else {
+        this.pool.schedule();
+      }
+    };
+    this.child.on("error", (e) => onExit(e.message));
+    this.child.on("exit", (code, signal) => onExit(code ?? signal));
+  }
+
+  // Descriptor line, then the text itself on the same pipe
+  run(job) {
+    this.job = job;
+    job.state = "running";
+    job.worker = this.index;
+    job.startedAt = new Date().toISOString();
+    const cfg = this.pool.cfg;
+    const query = `--pattern-size ${job.patternSize} --num-patterns ${cfg.numPatterns}`;
+    if (job.file) {
+      // Stored upload: the worker maps the file itself
+      this.child.stdin.write(`--text-file '${job.file}' ${query}\n`);
+    } else {
+      this.child.stdin.write(`--text-bytes ${job.text.length} ${query}\n`);
+      this.child.stdin.write(job.text);
+    }
+  }
+
+  finish(error, stats) {
+    const job = this.job;
+    this.job = null;
+    job.text = null;
+    job.finishedAt = new Date().toISOString();
+    if (error) {
+      job.state = "failed";
+      job.error = error.message;
+    } else {
+      job.state = "done";
+      job.stats = stats;
+    }
+    this.pool.evict();
+    this.pool.schedule();
+  }
+}
+
+export class MpcPool {
+  constructor(cfg = {}) {
+    this.cfg = { ...POOL_DEFAULTS, ...cfg };
+    this.closed = false;
+    this.queue = [];
+    this.jobs = new Map();
+    this.workers = [];
+    for (let i = 0; i < this.cfg.workers; i++) this.workers.push(new MpcWorker(this, i));
+  }
+
+  get enabled() {
+    return this.workers.length > 0;
+  }
+
+  // Queue a matching job on `text` (Buffer); returns the job record (state queued|running|done|failed)
+  submit(id, text, patternSize = this.cfg.patternSize) {
+    return this.enqueue({ id, size: text.length, patternSize, text });
+  }
+
+  // Queue a matching job on a stored file of `size` bytes; the path goes single-quoted into the
+  // descriptor line, so one with a quote or a line break is rejected
+  submitFile(id, file, size, patternSize = this.cfg.patternSize) {
+    if (/['\r\n]/.test(file)) {
+      throw new Error("text file path must not contain quotes or line breaks");
+    }
+    return this.enqueue({ id, size, patternSize, file });
+  }
+
+  enqueue(fields) {
+    if (!(fields.patternSize > 0) || fields.patternSize >= fields.size) {
+      throw new Error("pattern size must be positive and smaller than the text");
+    }
+    const job = { ...fields, state: "queued", results: [], queuedAt: new Date().toISOString() };
+    this.jobs.set(job.id, job);
+    this.queue.push(job);
+    this.schedule();
+    this.evict();
+    return job;
+  }
+
+  // Drop finished jobs older than jobTtlMs, then the oldest finished ones above maxJobs
+  // (queued and running jobs are never dropped)
+  evict() {
+    const cutoff = Date.now() - this.cfg.jobTtlMs;
+    const finished = [];
+    for (const job of this.jobs.values()) {
+      if (!job.finishedAt) continue;
+      if (Date.parse(job.finishedAt) < cutoff) this.jobs.delete(job.id);
+      else finished.push(job);
+    }
+    finished.sort((a, b) => Date.parse(a.finishedAt) - Date.parse(b.finishedAt));
+    for (const job of finished) {
+      if (this.jobs.size <= this.cfg.maxJobs) break;
+      this.jobs.delete(job.id);
+    }
+  }
+
+  // Hand queued jobs to idle workers, FIFO; with every worker retired they fail right away
+  schedule() {
+    if (this.workers.every((worker) => worker.retired)) {
+      for (const job of this.queue.splice(0)) {
+        job.state = "failed";
+        job.error = "no exact_pm worker left in sync with its peer";
+        job.text = null;
+        job.finishedAt = new Date().toISOString();
+      }
+      return;
+    }
+    for (const worker of this.workers) {
+      if (this.queue.length === 0) return;
+      if (worker.alive && !worker.job) worker.run(this.queue.shift());
+    }
+  }
+
+  close() {
+    this.closed = true;
+    for (const worker of this.workers) if (worker.alive) worker.child.stdin.end("quit\n");
+  }
+}
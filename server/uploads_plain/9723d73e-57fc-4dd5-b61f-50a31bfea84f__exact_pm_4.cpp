@@ -21,13 +21,46 @@
 // SOFTWARE.
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <random>
 #include <regex>
 #include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__AVX512BW__) || defined(__AES__)
+#include <immintrin.h>
+#endif
 
 #include <boost/algorithm/string.hpp>
 #include <boost/json/serialize.hpp>
@@ -59,9 +92,79 @@ using namespace MOTION::proto::gmw;
 using NewWire = MOTION::NewWire;
 using WireVector = std::vector<std::shared_ptr<NewWire>>;
 
+// Read-only memory mapping of a whole input file (--text-file / --pattern-file)
+// Pages are faulted in on first access, so a chunk only touches the part of the file it reads
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) : path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) == -1) {
+      int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+    }
+    size_ = static_cast<std::size_t>(file_stat.st_size);
+    if (size_ != 0) {
+      void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot map " + path);
+      }
+      // Inputs are read front to back, chunk by chunk
+      ::madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const std::string& path() const { return path_; }
+  std::size_t size() const { return size_; }
+  std::string_view view(std::size_t offset, std::size_t length) const { return {data_ + offset, length}; }
+
+ private:
+  std::string path_;
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+// How windows are compared with the pattern (--mode)
+enum class MatchMode {
+  hash,     // local AES hash of the share differences, hashes shared again (Phase 2), word-wise zero tests
+  rolling,  // linear fingerprint of the differences over Z_{2^B} shares, one zero test per window
+};
+
+// What a query reveals about the per-window match bits (--result-mode)
+enum class ResultMode {
+  shares,     // nothing is revealed, every party prints its own share of each window's bit
+  any,        // one bit per pattern: does it occur anywhere (OR tree in the circuit)
+  count,      // one integer per pattern: the number of matching windows (B2A + local sum)
+  positions,  // the match bit of every window
+};
+
+// any and count are revealed once per query over all chunks, positions once per chunk
+bool revealed_per_query(ResultMode mode) {
+  return mode == ResultMode::any || mode == ResultMode::count;
+}
+
 struct Options {
   std::size_t threads;
   bool json;
+  bool verbose;  // per-window debug dumps on stdout (never with --json)
   std::size_t num_repetitions;
   std::size_t num_simd;
   bool sync_between_setup_and_online;
@@ -72,14 +175,177 @@ struct Options {
   // std::uint64_t ring_size;
   std::size_t my_id;
   MOTION::Communication::tcp_parties_config tcp_config;
+  std::string shm_name;  // --party <id>,shm:/name: both parties on one host, over a shared-memory segment
+  std::size_t tcp_streams = 1;       // --party <id>,<host>,<port>,<streams>: sockets striped per peer
+  std::size_t tcp_buffer_bytes = 0;  // --tcp-buffer-bytes: SO_SNDBUF / SO_RCVBUF of striped sockets
   bool no_run = false;
+  bool simd_inputs = false;
+  std::size_t hash_word_bits = 64;
+  MatchMode match_mode = MatchMode::hash;
+  std::size_t fingerprint_bits = 256;  // --mode hash: hash output width, shared and compared in Phases 2 and 3
+  std::size_t ring_bits = 64;        // --mode rolling: ring Z_{2^B} of the character shares
+  std::uint64_t rolling_seed = 1;    // --mode rolling: seed of the fingerprint coefficients
+
+  // Service mode: queries arrive as descriptors on a control channel
+  bool service = false;
+  std::string control;
+  std::size_t query_id = 0;
+
+  // Chunked evaluation: windows per chunk (0: one chunk) and chunks built into one backend run
+  std::size_t chunk_windows = 0;
+  std::size_t chunks_in_flight = 2;
+  ResultMode result_mode = ResultMode::shares;
   
   // New fields for secret sharing
+  // pattern holds num_patterns patterns of pattern_size characters each, concatenated (--patterns)
+  std::size_t num_patterns = 1;
   std::string pattern;
   std::string text;
   std::string role;
+
+  // --pattern-file / --text-file: the input is read from the mapping and pattern / text stay empty;
+  // text_offset is the first character of this chunk in the mapped text
+  std::shared_ptr<const MappedFile> pattern_file;
+  std::shared_ptr<const MappedFile> text_file;
+  std::size_t text_offset = 0;
+
+  // --text-bytes: text_size raw bytes follow the query descriptor on the control channel
+  bool text_follows = false;
+
+  // --coalesce-bytes / --coalesce-delay-us: send-side batching of transport messages (0: off)
+  std::size_t coalesce_bytes = 0;
+  std::size_t coalesce_delay_us = 50;
 };
 
+// Pattern characters of a query (all patterns of a batch), mapped or from --pattern / --patterns
+std::string_view pattern_bytes(const Options& options) {
+  if (options.pattern_file) {
+    return options.pattern_file->view(0, options.pattern_file->size());
+  }
+  return options.pattern;
+}
+
+// Text characters of a query or chunk, mapped or from --text
+std::string_view text_bytes(const Options& options) {
+  if (options.text_file) {
+    return options.text_file->view(options.text_offset, options.text_size);
+  }
+  return options.text;
+}
+
+// Map an input file for parse_query_inputs, reporting failures like the other input errors
+std::shared_ptr<const MappedFile> map_input_file(const std::string& path) {
+  try {
+    return std::make_shared<const MappedFile>(path);
+  } catch (const std::system_error& e) {
+    std::cerr << e.what() << "\n";
+    return nullptr;
+  }
+}
+
+// Per-query options: given on the command line, or as one descriptor line per query in --service mode
+po::options_description query_options_description() {
+  po::options_description desc("Query options");
+  // clang-format off
+  desc.add_options()
+    ("pattern", po::value<std::string>(), "pattern string for pattern holder")
+    ("pattern-file", po::value<std::string>(), "file holding the pattern (raw bytes) for pattern holder")
+    ("patterns", po::value<std::string>(),
+     "comma-separated patterns of equal length for pattern holder, matched as one batch")
+    ("num-patterns", po::value<std::size_t>()->default_value(1), "expected number of patterns for text holder")
+    ("text", po::value<std::string>(), "text string for text holder")
+    ("text-file", po::value<std::string>(), "file holding the text (raw bytes) for text holder, memory-mapped")
+    ("text-bytes", po::value<std::uint64_t>(),
+     "text holder in --service mode: the text is the next N raw bytes on the control channel")
+    ("pattern-size", po::value<std::uint64_t>(), "expected pattern size for text holder")
+    ("text-size", po::value<std::uint64_t>(), "expected text size for pattern holder")
+    ;
+  // clang-format on
+  return desc;
+}
+
+// Read the role-specific query inputs (--pattern and --text-size, or --text and --pattern-size)
+bool parse_query_inputs(Options& options, const po::variables_map& vm) {
+  if (options.role == "pattern_holder") {
+    if (vm.count("pattern") + vm.count("pattern-file") + vm.count("patterns") != 1) {
+      std::cerr << "pattern_holder must provide exactly one of --pattern, --pattern-file or --patterns\n";
+      return false;
+    }
+    if (vm.count("pattern-file")) {
+      options.pattern_file = map_input_file(vm["pattern-file"].as<std::string>());
+      if (!options.pattern_file) {
+        return false;
+      }
+      options.pattern_size = options.pattern_file->size();
+      options.num_patterns = 1;
+    } else if (vm.count("pattern")) {
+      options.pattern = vm["pattern"].as<std::string>();
+      options.pattern_size = options.pattern.length();
+      options.num_patterns = 1;
+    } else {
+      // Batch query: all patterns share one circuit, so they must have the same length
+      // (patterns of different lengths go into separate queries, one per length)
+      std::vector<std::string> patterns;
+      boost::algorithm::split(patterns, vm["patterns"].as<std::string>(), boost::is_any_of(","));
+      options.pattern_size = patterns.front().length();
+      for (const auto& pattern : patterns) {
+        if (pattern.empty() || pattern.length() != options.pattern_size) {
+          std::cerr << "all --patterns must be non-empty and of the same length\n";
+          return false;
+        }
+      }
+      options.pattern = boost::algorithm::join(patterns, "");
+      options.num_patterns = patterns.size();
+    }
+    
+    if (!vm.count("text-size")) {
+      std::cerr << "pattern_holder must provide expected text size via --text-size\n";
+      return false;
+    }
+    options.text_size = vm["text-size"].as<std::uint64_t>();
+  } else if (options.role == "text_holder") {
+    if (vm.count("text") + vm.count("text-file") + vm.count("text-bytes") != 1) {
+      std::cerr << "text_holder must provide exactly one of --text, --text-file or --text-bytes\n";
+      return false;
+    }
+    if (vm.count("text-bytes")) {
+      // Read by run_service right after the descriptor line
+      options.text_size = vm["text-bytes"].as<std::uint64_t>();
+      options.text_follows = true;
+    } else if (vm.count("text-file")) {
+      options.text_file = map_input_file(vm["text-file"].as<std::string>());
+      if (!options.text_file) {
+        return false;
+      }
+      options.text_size = options.text_file->size();
+    } else {
+      options.text = vm["text"].as<std::string>();
+      options.text_size = options.text.length();
+    }
+    
+    if (!vm.count("pattern-size")) {
+      std::cerr << "text_holder must provide expected pattern size via --pattern-size\n";
+      return false;
+    }
+    options.pattern_size = vm["pattern-size"].as<std::uint64_t>();
+    options.num_patterns = vm["num-patterns"].as<std::size_t>();
+    if (options.num_patterns == 0) {
+      std::cerr << "num-patterns must be at least 1\n";
+      return false;
+    }
+  }
+  
+  if (options.pattern_size == 0) {
+    std::cerr << "pattern must not be empty\n";
+    return false;
+  }
+  if (options.pattern_size >= options.text_size) {
+    std::cerr << "pattern size must be smaller than text size\n";
+    return false;
+  }
+  return true;
+}
+
 std::optional<Options> parse_program_options(int argc, char* argv[]) {
   Options options;
   boost::program_options::options_description desc("Allowed options");
@@ -89,21 +355,56 @@ std::optional<Options> parse_program_options(int argc, char* argv[]) {
     ("config-file", po::value<std::string>(), "config file containing options")
     ("my-id", po::value<std::size_t>()->required(), "my party id")
     ("party", po::value<std::vector<std::string>>()->multitoken(),
-     "(party id, IP, port), e.g., --party 1,127.0.0.1,7777")
-    ("threads", po::value<std::size_t>()->default_value(0), "number of threads to use for gate evaluation")
+     "(party id, IP, port[, streams]), e.g., --party 1,127.0.0.1,7777; with streams > 1 large messages "
+     "are striped over that many TCP connections (the link uses the larger count of both entries); "
+     "or (party id, shm:/name) for both parties to connect co-located parties through the "
+     "shared-memory segment /name")
+    ("tcp-buffer-bytes", po::value<std::size_t>()->default_value(0),
+     "socket send / receive buffer size of striped TCP streams (0: kernel autotuning)")
+    ("threads", po::value<std::size_t>()->default_value(0), "number of threads to use for gate evaluation and the local hash stage")
     ("json", po::bool_switch()->default_value(false), "output data in JSON format")
-    ("pattern", po::value<std::string>(), "pattern string for pattern holder")
-    ("text", po::value<std::string>(), "text string for text holder")
-    ("pattern-size", po::value<std::uint64_t>(), "expected pattern size for text holder")
-    ("text-size", po::value<std::uint64_t>(), "expected text size for pattern holder")
+    ("verbose", po::bool_switch()->default_value(false),
+     "print per-window debug dumps (inputs, shares, differences, hashes); ignored with --json")
     ("role", po::value<std::string>()->required(), "role: pattern_holder or text_holder")
     ("repetitions", po::value<std::size_t>()->default_value(1), "number of repetitions")
     ("num-simd", po::value<std::size_t>()->default_value(1), "number of SIMD values")
     ("sync-between-setup-and-online", po::bool_switch()->default_value(false),
      "run a synchronization protocol before the online phase starts")
     ("no-run", po::bool_switch()->default_value(false), "just build the circuit, but not execute it")
+    ("simd-inputs", po::bool_switch()->default_value(false),
+     "share the whole text and pattern once as one SIMD input each instead of once per window position")
+    ("hash-word-bits", po::value<std::size_t>()->default_value(64),
+     "word size (8, 16, 32 or 64) in which hashes are shared and compared in Phases 2 and 3")
+    ("fingerprint-bits", po::value<std::size_t>()->default_value(256),
+     "--mode hash: hash output width (a multiple of --hash-word-bits, at most 256) computed in Phase 1 "
+     "and shared and compared in Phases 2 and 3")
+    ("mode", po::value<std::string>()->default_value("hash"),
+     "hash: AES hash of the share differences, shared and compared word by word; rolling: linear "
+     "fingerprint over Z_2^ring-bits shares, one zero test per window and no hash sharing")
+    ("ring-bits", po::value<std::size_t>()->default_value(64),
+     "--mode rolling: ring width B (16, 32 or 64); a non-matching window passes with probability <= 2^(7-B)")
+    ("rolling-seed", po::value<std::uint64_t>()->default_value(1),
+     "--mode rolling: seed of the fingerprint coefficients, must be the same for both parties")
+    ("service", po::bool_switch()->default_value(false),
+     "keep the connection open and run one query per descriptor line read from --control")
+    ("control", po::value<std::string>()->default_value("-"),
+     "control channel for --service: file or FIFO with query descriptors, - for stdin")
+    ("chunk-windows", po::value<std::size_t>()->default_value(0),
+     "evaluate the windows in chunks of this many windows (0: all windows in one circuit)")
+    ("chunks-in-flight", po::value<std::size_t>()->default_value(2),
+     "chunks built into one backend run with --chunk-windows, so one chunk's input sharing overlaps "
+     "the previous chunk's HAM/DPF")
+    ("result-mode", po::value<std::string>()->default_value("shares"),
+     "what is revealed per pattern: shares (nothing, print local shares), any (found or not), "
+     "count (number of matching windows) or positions (match bit of every window)")
+    ("coalesce-bytes", po::value<std::size_t>()->default_value(0),
+     "batch outgoing messages into frames of up to this many bytes (0: one frame per message); "
+     "both parties need the same setting")
+    ("coalesce-delay-us", po::value<std::size_t>()->default_value(50),
+     "with --coalesce-bytes: longest time a message waits in a partial frame")
     ;
   // clang-format on
+  desc.add(query_options_description());
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -127,56 +428,87 @@ std::optional<Options> parse_program_options(int argc, char* argv[]) {
   options.my_id = vm["my-id"].as<std::size_t>();
   options.threads = vm["threads"].as<std::size_t>();
   options.json = vm["json"].as<bool>();
+  // stdout carries only JSON lines with --json
+  options.verbose = vm["verbose"].as<bool>() && !options.json;
   options.num_repetitions = vm["repetitions"].as<std::size_t>();
   options.num_simd = vm["num-simd"].as<std::size_t>();
   options.sync_between_setup_and_online = vm["sync-between-setup-and-online"].as<bool>();
   options.no_run = vm["no-run"].as<bool>();
+  options.simd_inputs = vm["simd-inputs"].as<bool>();
+  options.hash_word_bits = vm["hash-word-bits"].as<std::size_t>();
+  options.fingerprint_bits = vm["fingerprint-bits"].as<std::size_t>();
+  options.ring_bits = vm["ring-bits"].as<std::size_t>();
+  options.rolling_seed = vm["rolling-seed"].as<std::uint64_t>();
+  options.service = vm["service"].as<bool>();
+  options.control = vm["control"].as<std::string>();
+  options.chunk_windows = vm["chunk-windows"].as<std::size_t>();
+  options.chunks_in_flight = vm["chunks-in-flight"].as<std::size_t>();
+  options.coalesce_bytes = vm["coalesce-bytes"].as<std::size_t>();
+  options.coalesce_delay_us = vm["coalesce-delay-us"].as<std::size_t>();
+  options.tcp_buffer_bytes = vm["tcp-buffer-bytes"].as<std::size_t>();
+  if (options.chunks_in_flight == 0) {
+    std::cerr << "chunks-in-flight must be at least 1\n";
+    return std::nullopt;
+  }
+  const std::string result_mode = vm["result-mode"].as<std::string>();
+  if (result_mode == "shares") {
+    options.result_mode = ResultMode::shares;
+  } else if (result_mode == "any") {
+    options.result_mode = ResultMode::any;
+  } else if (result_mode == "count") {
+    options.result_mode = ResultMode::count;
+  } else if (result_mode == "positions") {
+    options.result_mode = ResultMode::positions;
+  } else {
+    std::cerr << "result-mode must be one of shares, any, count, positions\n";
+    return std::nullopt;
+  }
+  if (options.hash_word_bits != 8 && options.hash_word_bits != 16 && options.hash_word_bits != 32 &&
+      options.hash_word_bits != 64) {
+    std::cerr << "hash-word-bits must be one of 8, 16, 32, 64\n";
+    return std::nullopt;
+  }
+  if (options.fingerprint_bits == 0 || options.fingerprint_bits > 256 ||
+      options.fingerprint_bits % options.hash_word_bits != 0) {
+    std::cerr << "fingerprint-bits must be a positive multiple of hash-word-bits, at most 256\n";
+    return std::nullopt;
+  }
+  const std::string match_mode = vm["mode"].as<std::string>();
+  if (match_mode == "hash") {
+    options.match_mode = MatchMode::hash;
+  } else if (match_mode == "rolling") {
+    options.match_mode = MatchMode::rolling;
+  } else {
+    std::cerr << "mode must be either hash or rolling\n";
+    return std::nullopt;
+  }
+  if (options.ring_bits != 16 && options.ring_bits != 32 && options.ring_bits != 64) {
+    std::cerr << "ring-bits must be one of 16, 32, 64\n";
+    return std::nullopt;
+  }
 
   options.arithmetic_protocol = MOTION::MPCProtocol::ArithmeticGMW;
   options.boolean_protocol = MOTION::MPCProtocol::BooleanGMW;
   
   // Parse role and input strings
   options.role = vm["role"].as<std::string>();
-  
-  if (options.role == "pattern_holder") {
-    if (!vm.count("pattern")) {
-      std::cerr << "pattern_holder must provide --pattern\n";
-      return std::nullopt;
-    }
-    options.pattern = vm["pattern"].as<std::string>();
-    options.pattern_size = options.pattern.length();
-    
-    if (!vm.count("text-size")) {
-      std::cerr << "pattern_holder must provide expected text size via --text-size\n";
-      return std::nullopt;
-    }
-    options.text_size = vm["text-size"].as<std::uint64_t>();
-  } else if (options.role == "text_holder") {
-    if (!vm.count("text")) {
-      std::cerr << "text_holder must provide --text\n";
-      return std::nullopt;
-    }
-    options.text = vm["text"].as<std::string>();
-    options.text_size = options.text.length();
-    
-    if (!vm.count("pattern-size")) {
-      std::cerr << "text_holder must provide expected pattern size via --pattern-size\n";
-      return std::nullopt;
-    }
-    options.pattern_size = vm["pattern-size"].as<std::uint64_t>();
-  } else {
+  if (options.role != "pattern_holder" && options.role != "text_holder") {
     std::cerr << "role must be either 'pattern_holder' or 'text_holder'\n";
     return std::nullopt;
   }
-  
-  if (options.pattern_size >= options.text_size) {
-    std::cerr << "pattern size must be smaller than text size\n";
+
+  // In service mode the inputs come with each query descriptor instead
+  if (!options.service && vm.count("text-bytes")) {
+    std::cerr << "--text-bytes is only valid in query descriptors of --service mode\n";
+    return std::nullopt;
+  }
+  if (!options.service && !parse_query_inputs(options, vm)) {
     return std::nullopt;
   }
 
-  const auto parse_party_argument =
-      [](const auto& s) -> std::pair<std::size_t, MOTION::Communication::tcp_connection_config> {
-    const static std::regex party_argument_re("([012]),([^,]+),(\\d{1,5})");
+  const auto parse_party_argument = [](const auto& s)
+      -> std::tuple<std::size_t, MOTION::Communication::tcp_connection_config, std::size_t> {
+    const static std::regex party_argument_re("([012]),([^,]+),(\\d{1,5})(?:,(\\d{1,3}))?");
     std::smatch match;
     if (!std::regex_match(s, match, party_argument_re)) {
       throw std::invalid_argument("invalid party argument");
@@ -184,7 +516,8 @@ std::optional<Options> parse_program_options(int argc, char* argv[]) {
     auto id = boost::lexical_cast<std::size_t>(match[1]);
     auto host = match[2];
     auto port = boost::lexical_cast<std::uint16_t>(match[3]);
-    return {id, {host, port}};
+    std::size_t streams = match[4].matched ? boost::lexical_cast<std::size_t>(match[4]) : 1;
+    return {id, {host, port}, streams};
   };
 
   const std::vector<std::string> party_infos = vm["party"].as<std::vector<std::string>>();
@@ -193,17 +526,35 @@ std::optional<Options> parse_program_options(int argc, char* argv[]) {
     return std::nullopt;
   }
 
+  const static std::regex shm_argument_re("([01]),shm:(/[^,/]+)");
+  std::smatch shm0, shm1;
+  bool is_shm0 = std::regex_match(party_infos[0], shm0, shm_argument_re);
+  bool is_shm1 = std::regex_match(party_infos[1], shm1, shm_argument_re);
+  if (is_shm0 || is_shm1) {
+    if (!is_shm0 || !is_shm1 || shm0[1] == shm1[1] || shm0[2] != shm1[2]) {
+      std::cerr << "shared memory needs --party 0,shm:/name and --party 1,shm:/name with the same name\n";
+      return std::nullopt;
+    }
+    options.shm_name = shm0[2];
+    return options;
+  }
+
   options.tcp_config.resize(2);
   std::size_t other_id = 2;
 
-  const auto [id0, conn_info0] = parse_party_argument(party_infos[0]);
-  const auto [id1, conn_info1] = parse_party_argument(party_infos[1]);
+  const auto [id0, conn_info0, streams0] = parse_party_argument(party_infos[0]);
+  const auto [id1, conn_info1, streams1] = parse_party_argument(party_infos[1]);
   if (id0 == id1) {
     std::cerr << "need party arguments for party 0 and 1\n";
     return std::nullopt;
   }
   options.tcp_config[id0] = conn_info0;
   options.tcp_config[id1] = conn_info1;
+  options.tcp_streams = std::max(streams0, streams1);
+  if (options.tcp_streams == 0) {
+    std::cerr << "a party needs at least one TCP stream\n";
+    return std::nullopt;
+  }
 
   return options;
 }
@@ -211,954 +562,4028 @@ std::optional<Options> parse_program_options(int argc, char* argv[]) {
 
 
 
-std::unique_ptr<MOTION::Communication::CommunicationLayer> setup_communication(
-    const Options& options) {
-  MOTION::Communication::TCPSetupHelper helper(options.my_id, options.tcp_config);
-  return std::make_unique<MOTION::Communication::CommunicationLayer>(options.my_id,
-                                                                     helper.setup_connections());
-}
+// Frames sent / received by a CoalescingTransport, next to the messages they carried
+struct CoalescingStatistics {
+  std::size_t messages_sent = 0;
+  std::size_t frames_sent = 0;
+  std::size_t frame_bytes_sent = 0;  // payload plus the 4-byte length header of every message
+  std::size_t messages_received = 0;
+  std::size_t frames_received = 0;
+  std::size_t frame_bytes_received = 0;
 
-std::vector<uint64_t> convert_to_binary(uint64_t x) {
-    std::vector<uint64_t> res;
-    for (uint64_t i = 0; i < 64; ++i) {
-        if (x%2 == 1) res.push_back(1);
-        else res.push_back(0);
-        x /= 2;
-    }
-    return res;
-}
+  void add(const CoalescingStatistics& other) {
+    messages_sent += other.messages_sent;
+    frames_sent += other.frames_sent;
+    frame_bytes_sent += other.frame_bytes_sent;
+    messages_received += other.messages_received;
+    frames_received += other.frames_received;
+    frame_bytes_received += other.frame_bytes_received;
+  }
 
+  boost::json::object to_json() const {
+    auto ratio = [](std::size_t messages, std::size_t frames) {
+      return frames == 0 ? 0.0 : static_cast<double>(messages) / static_cast<double>(frames);
+    };
+    boost::json::object obj;
+    obj.emplace("messages_sent", messages_sent);
+    obj.emplace("frames_sent", frames_sent);
+    obj.emplace("frame_bytes_sent", frame_bytes_sent);
+    obj.emplace("messages_received", messages_received);
+    obj.emplace("frames_received", frames_received);
+    obj.emplace("frame_bytes_received", frame_bytes_received);
+    obj.emplace("coalescing_ratio_sent", ratio(messages_sent, frames_sent));
+    obj.emplace("coalescing_ratio_received", ratio(messages_received, frames_received));
+    return obj;
+  }
+};
 
-// String processing namespace for pattern matching functionality
-namespace StringProcessing {
-    
-  // Convert string to vector of uint8_t values (ASCII)
-  std::vector<uint8_t> string_to_integers(const std::string& str) {
-    std::vector<uint8_t> result;
-    for (char c : str) {
-      result.push_back(static_cast<uint8_t>(c));
-    }
-    return result;
+// Transport decorator that batches the many small messages of scalar gates into larger frames
+// A frame is a sequence of (4-byte little-endian length, payload) records and goes out once it
+// holds coalesce_bytes bytes or its first message has waited coalesce_delay_us; the receiving side
+// splits frames back into the original messages, in order. Both ends have to be wrapped
+// The inherited statistics count the original messages, so the ledger residuals stay comparable
+class CoalescingTransport : public MOTION::Communication::Transport {
+ public:
+  CoalescingTransport(std::unique_ptr<MOTION::Communication::Transport> inner, std::size_t max_frame_bytes,
+                      std::chrono::microseconds max_delay)
+      : inner_(std::move(inner)), max_frame_bytes_(max_frame_bytes), max_delay_(max_delay),
+        flusher_([this] { flush_loop(); }) {}
+
+  ~CoalescingTransport() override { shutdown(); }
+
+  void send_message(std::vector<std::uint8_t>&& message) override {
+    send_message(static_cast<const std::vector<std::uint8_t>&>(message));
   }
-  
-  // Break pattern into individual characters
-  // Example: "HEL" -> ["H", "E", "L"]
-  std::vector<std::string> break_pattern_into_chars(const std::string& pattern) {
-    std::vector<std::string> result;
-    for (char c : pattern) {
-      result.push_back(std::string(1, c));
+
+  void send_message(const std::vector<std::uint8_t>& message) override {
+    if (message.size() > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::length_error("message too large for a coalesced frame");
+    }
+    std::unique_lock lock(send_mutex_);
+    auto length = static_cast<std::uint32_t>(message.size());
+    for (std::size_t i = 0; i < sizeof(length); ++i) {
+      frame_.push_back(static_cast<std::uint8_t>(length >> (8 * i)));
+    }
+    frame_.insert(frame_.end(), message.begin(), message.end());
+    ++frame_messages_;
+    ++statistics_.num_messages_sent;
+    statistics_.num_bytes_sent += message.size();
+
+    if (frame_.size() >= max_frame_bytes_) {
+      flush_locked();
+    } else if (frame_messages_ == 1) {
+      deadline_ = std::chrono::steady_clock::now() + max_delay_;
+      flush_cv_.notify_one();
     }
-    return result;
   }
-  
-  // Create sliding window substrings from text
-  // Example: text="HELLO", pattern_size=3 -> [["H","E","L"], ["E","L","L"], ["L","L","O"]]
-  std::vector<std::vector<std::string>> create_sliding_windows(const std::string& text, size_t pattern_size) {
-    std::vector<std::vector<std::string>> windows;
-    
-    if (text.length() < pattern_size) {
-      return windows; // Return empty if text is shorter than pattern
+
+  bool available() const override {
+    {
+      std::scoped_lock lock(receive_mutex_);
+      if (!received_.empty()) {
+        return true;
+      }
     }
-    
-    for (size_t i = 0; i <= text.length() - pattern_size; ++i) {
-      std::vector<std::string> window;
-      for (size_t j = 0; j < pattern_size; ++j) {
-        window.push_back(std::string(1, text[i + j]));
+    return inner_->available();
+  }
+
+  // Called by the receive thread of the communication layer only
+  std::optional<std::vector<std::uint8_t>> receive_message() override {
+    {
+      std::scoped_lock lock(receive_mutex_);
+      if (!received_.empty()) {
+        return pop_received();
       }
-      windows.push_back(window);
     }
-    
-    return windows;
+    auto frame = inner_->receive_message();
+    if (!frame.has_value()) {
+      return std::nullopt;
+    }
+    std::scoped_lock lock(receive_mutex_);
+    split_frame(*frame);
+    return pop_received();
   }
-  
-  // Convert pattern characters to uint8_t values for secret sharing
-  std::vector<uint8_t> pattern_chars_to_integers(const std::vector<std::string>& pattern_chars) {
-    std::vector<uint8_t> result;
-    for (const auto& char_str : pattern_chars) {
-      if (!char_str.empty()) {
-        result.push_back(static_cast<uint8_t>(char_str[0]));
+
+  void shutdown() override {
+    {
+      std::unique_lock lock(send_mutex_);
+      if (stopped_) {
+        return;
       }
+      flush_locked();
+      stopped_ = true;
     }
+    flush_cv_.notify_one();
+    flusher_.join();
+    inner_->shutdown();
+  }
+
+  // Frame counts since the last call
+  CoalescingStatistics take_statistics() {
+    std::scoped_lock lock(send_mutex_, receive_mutex_);
+    CoalescingStatistics result = coalescing_;
+    coalescing_ = {};
     return result;
   }
-  
-  // Convert sliding window substrings to uint8_t values for secret sharing
-  std::vector<std::vector<uint8_t>> sliding_windows_to_integers(const std::vector<std::vector<std::string>>& windows) {
-    std::vector<std::vector<uint8_t>> result;
-    result.reserve(windows.size());
 
-    for (const auto& window : windows) {
-      result.push_back(pattern_chars_to_integers(window)); 
+ private:
+  // Send the partial frame, with send_mutex_ held so frames leave in message order
+  void flush_locked() {
+    if (frame_messages_ == 0) {
+      return;
     }
+    {
+      std::scoped_lock lock(receive_mutex_);
+      coalescing_.messages_sent += frame_messages_;
+      ++coalescing_.frames_sent;
+      coalescing_.frame_bytes_sent += frame_.size();
+    }
+    std::vector<std::uint8_t> frame;
+    frame.reserve(std::min(max_frame_bytes_, frame_.size()));
+    frame.swap(frame_);
+    frame_messages_ = 0;
+    inner_->send_message(std::move(frame));
+  }
 
-    return result;
+  // Flush frames whose first message has waited for max_delay_
+  void flush_loop() {
+    std::unique_lock lock(send_mutex_);
+    while (!stopped_) {
+      if (frame_messages_ == 0) {
+        flush_cv_.wait(lock, [this] { return stopped_ || frame_messages_ != 0; });
+      } else if (flush_cv_.wait_until(lock, deadline_) == std::cv_status::timeout) {
+        if (frame_messages_ != 0 && std::chrono::steady_clock::now() >= deadline_) {
+          flush_locked();
+        }
+      }
+    }
   }
 
-  // Print pattern breakdown for debugging
-  template <typename T>
-  void print_vector(const std::vector<T>& input_vector) {
-    std::cout << "[";
-    for (size_t i = 0; i < input_vector.size(); ++i) {
-      std::cout << "\"" << input_vector[i] << "\"";
-      if (i < input_vector.size() - 1) std::cout << ", ";
+  // With receive_mutex_ held
+  void split_frame(const std::vector<std::uint8_t>& frame) {
+    std::size_t pos = 0;
+    while (pos < frame.size()) {
+      if (frame.size() - pos < sizeof(std::uint32_t)) {
+        throw std::runtime_error("truncated record header in coalesced frame");
+      }
+      std::uint32_t length = 0;
+      for (std::size_t i = 0; i < sizeof(length); ++i) {
+        length |= static_cast<std::uint32_t>(frame[pos + i]) << (8 * i);
+      }
+      pos += sizeof(length);
+      if (frame.size() - pos < length) {
+        throw std::runtime_error("truncated record in coalesced frame");
+      }
+      received_.emplace_back(frame.begin() + pos, frame.begin() + pos + length);
+      pos += length;
+      ++coalescing_.messages_received;
+      ++statistics_.num_messages_received;
+      statistics_.num_bytes_received += length;
     }
-    std::cout << "]" << std::endl;
+    ++coalescing_.frames_received;
+    coalescing_.frame_bytes_received += frame.size();
   }
-  
-  // Print sliding windows for debugging
-  template <typename T>
-  void print_nested_vector(const std::vector<std::vector<T>>& windows) {
-    std::cout << "[";
-    for (size_t i = 0; i < windows.size(); ++i) {
-        std::cout << "[";
-        for (size_t j = 0; j < windows[i].size(); ++j) {
-            std::cout << "\"" << windows[i][j] << "\"";
-            if (j < windows[i].size() - 1) std::cout << ", ";
+
+  std::vector<std::uint8_t> pop_received() {
+    auto message = std::move(received_.front());
+    received_.pop_front();
+    return message;
+  }
+
+  std::unique_ptr<MOTION::Communication::Transport> inner_;
+  std::size_t max_frame_bytes_;
+  std::chrono::microseconds max_delay_;
+
+  std::mutex send_mutex_;  // frame_, frame_messages_, deadline_, stopped_
+  std::condition_variable flush_cv_;
+  std::vector<std::uint8_t> frame_;
+  std::size_t frame_messages_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+  bool stopped_ = false;
+
+  mutable std::mutex receive_mutex_;  // received_, coalescing_
+  std::deque<std::vector<std::uint8_t>> received_;
+  CoalescingStatistics coalescing_;
+
+  std::thread flusher_;  // last member: starts once everything above is initialized
+};
+
+// Transport between two co-located parties over one POSIX shared-memory segment (--party <id>,shm:/name)
+// The segment holds one single-producer / single-consumer byte ring per direction; a message is a
+// 4-byte length and its payload, copied into the ring and published with one release store of the
+// ring head, so a message costs two memcpy and no system call. Waiting spins first and only backs
+// off to yield / sleep after a while, so ping-pong latency stays far below the loopback TCP stack
+// Party 0 creates the segment and unlinks it once party 1 has attached; a peer that dies without
+// shutting down is not detected (the other side keeps waiting, like a TCP peer that never answers)
+class ShmTransport : public MOTION::Communication::Transport {
+ public:
+  static constexpr std::size_t ring_bytes = std::size_t{1} << 22;  // per direction, power of two
+
+  // Create (party 0) or attach to (party 1) segment `name`, waiting up to `timeout` for the peer
+  ShmTransport(const std::string& name, std::size_t my_id,
+               std::chrono::milliseconds timeout = std::chrono::seconds(60))
+      : my_id_(my_id) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto check_deadline = [&](const char* what) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        throw std::runtime_error("shared memory " + name + ": timeout waiting for " + what);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    if (my_id == 0) {
+      shm_unlink(name.c_str());  // left over from a run that died before party 1 attached
+      int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot create shared memory " + name);
+      }
+      if (ftruncate(fd, sizeof(Segment)) != 0) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "cannot size shared memory " + name);
+      }
+      map(fd, name);
+      segment_ = new (mapping_) Segment();
+      segment_->state.store(ready, std::memory_order_release);
+      while (segment_->state.load(std::memory_order_acquire) != attached) {
+        check_deadline("party 1");
+      }
+      shm_unlink(name.c_str());
+    } else {
+      while (true) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd >= 0) {
+          struct stat st {};
+          if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(Segment)) {
+            map(fd, name);
+            segment_ = static_cast<Segment*>(mapping_);
+            std::uint32_t expected = ready;
+            if (segment_->state.compare_exchange_strong(expected, attached, std::memory_order_acq_rel)) {
+              break;
+            }
+            unmap();
+          } else {
+            close(fd);
+          }
         }
-        std::cout << "]";
-        // if (i < windows.size() - 1) std::cout << ", ";
+        check_deadline("party 0");
+      }
     }
-    std::cout << "]" << std::endl;
+    out_ = &segment_->rings[my_id_];
+    in_ = &segment_->rings[1 - my_id_];
   }
 
-  // Concat a vector of type T into string
-  template <typename T>
-  std::string concat_vector(const std::vector<T>& target_vector) {
-    std::string final_result {};
+  ~ShmTransport() override {
+    shutdown();
+    unmap();
+  }
 
-    for (T el : target_vector) {
-      final_result += std::to_string(el);
+  void send_message(std::vector<std::uint8_t>&& message) override {
+    send_message(static_cast<const std::vector<std::uint8_t>&>(message));
+  }
+
+  void send_message(const std::vector<std::uint8_t>& message) override {
+    if (message.size() > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::length_error("message too large for the shared memory transport");
+    }
+    std::scoped_lock lock(send_mutex_);
+    std::array<std::uint8_t, sizeof(std::uint32_t)> header;
+    auto length = static_cast<std::uint32_t>(message.size());
+    for (std::size_t i = 0; i < header.size(); ++i) {
+      header[i] = static_cast<std::uint8_t>(length >> (8 * i));
+    }
+    std::uint64_t head = out_->head.load(std::memory_order_relaxed);
+    if (free_bytes(head) >= header.size() + message.size()) {
+      // Common case: header and payload in place at once, one publication
+      copy_in(head, header.data(), header.size());
+      copy_in(head + header.size(), message.data(), message.size());
+      out_->head.store(head + header.size() + message.size(), std::memory_order_release);
+    } else {
+      write_bytes(header.data(), header.size());
+      write_bytes(message.data(), message.size());
     }
+    ++statistics_.num_messages_sent;
+    statistics_.num_bytes_sent += message.size();
+  }
 
-    return final_result;
+  bool available() const override {
+    return in_->head.load(std::memory_order_acquire) != in_->tail.load(std::memory_order_relaxed);
   }
 
-  std::vector<uint8_t> hash_difference_vector(const std::vector<uint8_t>& differences) {
-    const size_t hash_size = 32;  // 256 bits output
-    const size_t required_input_size = 16;  // AES requires exactly 16 bytes input
-    
-    // Create 16-byte input buffer (pad with zeros)
-    uint8_t input_buffer[required_input_size] = {0};  // Initialize all to 0
-    
-    // Copy your differences (copy min of available vs required)
-    size_t copy_size = std::min(differences.size(), required_input_size);
-    std::copy(differences.begin(), differences.begin() + copy_size, input_buffer);
-    
-    // If differences is larger than 16 bytes, XOR the excess into the buffer
-    for (size_t i = required_input_size; i < differences.size(); ++i) {
-        input_buffer[i % required_input_size] ^= differences[i];
+  // Called by the receive thread of the communication layer only; std::nullopt after shutdown
+  std::optional<std::vector<std::uint8_t>> receive_message() override {
+    std::array<std::uint8_t, sizeof(std::uint32_t)> header;
+    if (!read_bytes(header.data(), header.size())) {
+      return std::nullopt;
     }
-    
-    uint8_t hash_output[hash_size];
-    
-    // Now input is exactly 16 bytes!
-    G_tiny(input_buffer, hash_output, required_input_size, hash_size);
-    
-    return std::vector<uint8_t>(hash_output, hash_output + hash_size);
+    std::uint32_t length = 0;
+    for (std::size_t i = 0; i < header.size(); ++i) {
+      length |= static_cast<std::uint32_t>(header[i]) << (8 * i);
+    }
+    std::vector<std::uint8_t> message(length);
+    if (!read_bytes(message.data(), length)) {
+      throw std::runtime_error("shared memory transport closed inside a message");
+    }
+    ++statistics_.num_messages_received;
+    statistics_.num_bytes_received += length;
+    return message;
   }
 
-  // String processing for pattern holder
-  auto pattern_holder(const std::string& pattern) {
-    std::cout << "Pattern: \"" << pattern << "\"" << std::endl;
+  void shutdown() override {
+    if (segment_ != nullptr && !stopped_.exchange(true)) {
+      out_->closed.store(1, std::memory_order_release);
+    }
+  }
 
-    std::vector<std::string> pattern_vector = break_pattern_into_chars(pattern);
-    std:: cout << "Broken down to Char: \n";
-    print_vector(pattern_vector);
+ private:
+  // One direction: written by one party only, read by the other
+  struct Ring {
+    alignas(64) std::atomic<std::uint64_t> head{0};  // bytes written so far
+    alignas(64) std::atomic<std::uint64_t> tail{0};  // bytes read so far
+    alignas(64) std::atomic<std::uint32_t> closed{0};
+    alignas(64) std::uint8_t data[ring_bytes];
+  };
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared memory rings need lock-free atomics");
 
-    std::vector<uint8_t> pattern_ascii_vector = pattern_chars_to_integers(pattern_vector);
-     std:: cout << "Broken down to ASCII: \n";
-    print_vector(pattern_ascii_vector);
+  static constexpr std::uint32_t ready = 1;     // initialized by party 0
+  static constexpr std::uint32_t attached = 2;  // taken by party 1
+  struct Segment {
+    std::atomic<std::uint32_t> state{0};
+    Ring rings[2];  // rings[i] is written by party i
+  };
 
-    return pattern_ascii_vector;
-  }
+  // Spin, then yield, then sleep: waits that end quickly cost no system call
+  // Spinning only pays with a core for each party; on a single core the peer needs the CPU
+  class Backoff {
+   public:
+    void wait() {
+      static const std::size_t max_spins = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+      if (spins_ < max_spins) {
+        ++spins_;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      } else if (spins_ < max_spins + 256) {
+        ++spins_;
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+    void reset() { spins_ = 0; }
 
-  // String processing for text holder
-  auto text_holder(const std::string& text, size_t pattern_size) {
-    std::cout << "Original text: \"" << text << "\", pattern_size: " << pattern_size << std::endl;
+   private:
+    std::size_t spins_ = 0;
+  };
 
-    std::vector<std::vector<std::string>> text_vector = create_sliding_windows(text, pattern_size);
-    std:: cout << "Broken down to Char: \n";
-    print_nested_vector(text_vector);
+  void map(int fd, const std::string& name) {
+    void* mapping = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      throw std::system_error(error, std::generic_category(), "cannot map shared memory " + name);
+    }
+    mapping_ = mapping;
+  }
 
-    std::vector<std::vector<uint8_t>> text_ascii_vector = sliding_windows_to_integers(text_vector);
-    std:: cout << "Broken down to ASCII: \n";
-    print_nested_vector(text_ascii_vector);
+  void unmap() {
+    if (mapping_ != nullptr) {
+      munmap(mapping_, sizeof(Segment));
+      mapping_ = nullptr;
+      segment_ = nullptr;
+    }
+  }
 
-    return text_ascii_vector;
+  std::size_t free_bytes(std::uint64_t head) const {
+    return ring_bytes - static_cast<std::size_t>(head - out_->tail.load(std::memory_order_acquire));
   }
-}
 
+  // Copy into the outgoing ring at stream position `pos`, wrapping around its end
+  void copy_in(std::uint64_t pos, const std::uint8_t* src, std::size_t size) {
+    std::size_t offset = pos & (ring_bytes - 1);
+    std::size_t first = std::min(size, ring_bytes - offset);
+    std::memcpy(out_->data + offset, src, first);
+    std::memcpy(out_->data, src + first, size - first);
+  }
 
+  // Stream `size` bytes into the outgoing ring as space frees up (messages larger than the ring)
+  void write_bytes(const std::uint8_t* src, std::size_t size) {
+    Backoff backoff;
+    std::uint64_t head = out_->head.load(std::memory_order_relaxed);
+    while (size > 0) {
+      std::size_t n = std::min(size, free_bytes(head));
+      if (n == 0) {
+        if (stopped_.load(std::memory_order_relaxed)) {
+          throw std::runtime_error("shared memory transport shut down while sending");
+        }
+        backoff.wait();
+        continue;
+      }
+      backoff.reset();
+      copy_in(head, src, n);
+      head += n;
+      out_->head.store(head, std::memory_order_release);
+      src += n;
+      size -= n;
+    }
+  }
 
-// Structure to hold individual character wires and promises for secret sharing
+  // Read exactly `size` bytes from the incoming ring; false if the transport closed first
+  bool read_bytes(std::uint8_t* dst, std::size_t size) {
+    Backoff backoff;
+    std::uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+    while (size > 0) {
+      std::uint64_t head = in_->head.load(std::memory_order_acquire);
+      std::size_t n = std::min(size, static_cast<std::size_t>(head - tail));
+      if (n == 0) {
+        // Check the flags before a last look at the head, so nothing published before them is lost
+        if (stopped_.load(std::memory_order_relaxed) || in_->closed.load(std::memory_order_acquire)) {
+          if (in_->head.load(std::memory_order_acquire) == tail) {
+            return false;
+          }
+          continue;
+        }
+        backoff.wait();
+        continue;
+      }
+      backoff.reset();
+      std::size_t offset = tail & (ring_bytes - 1);
+      std::size_t first = std::min(n, ring_bytes - offset);
+      std::memcpy(dst, in_->data + offset, first);
+      std::memcpy(dst + first, in_->data, n - first);
+      tail += n;
+      in_->tail.store(tail, std::memory_order_release);
+      dst += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  std::size_t my_id_;
+  void* mapping_ = nullptr;
+  Segment* segment_ = nullptr;
+  Ring* out_ = nullptr;
+  Ring* in_ = nullptr;
+  std::mutex send_mutex_;
+  std::atomic<bool> stopped_{false};
+};
+
+// Traffic of one socket of a StripedTcpTransport
+struct StreamStatistics {
+  std::size_t chunks_sent = 0;
+  std::size_t bytes_sent = 0;  // payload plus chunk headers
+  std::size_t chunks_received = 0;
+  std::size_t bytes_received = 0;
+
+  void add(const StreamStatistics& other) {
+    chunks_sent += other.chunks_sent;
+    bytes_sent += other.bytes_sent;
+    chunks_received += other.chunks_received;
+    bytes_received += other.bytes_received;
+  }
+
+  boost::json::object to_json() const {
+    boost::json::object obj;
+    obj.emplace("chunks_sent", chunks_sent);
+    obj.emplace("bytes_sent", bytes_sent);
+    obj.emplace("chunks_received", chunks_received);
+    obj.emplace("bytes_received", bytes_received);
+    return obj;
+  }
+};
+
+// TCP transport over N parallel connections to one peer (--party <id>,<host>,<port>,<N>), so that
+// large messages are not limited by the window of a single connection on a high-BDP link
+// Every message gets a sequence number and is cut into chunks, each preceded by a header
+// (sequence, message size, offset, chunk size as 8-byte little-endian fields): a message below stripe_bytes is one chunk on
+// stream 0, a larger one is split into N chunks, one per stream. Every stream has its own writer
+// and reader thread; readers copy chunks into place and receive_message() hands out messages in
+// sequence order, so the communication layer above sees one ordered message stream
+// Party 0 listens on its own --party address and party 1 opens the N connections to it
+// A failed send or a malformed chunk breaks the link: later sends throw the error, waiting receivers
+// return nullopt after a send error and rethrow a receive error
+class StripedTcpTransport : public MOTION::Communication::Transport {
+ public:
+  static constexpr std::size_t stripe_bytes = std::size_t{256} << 10;
+  static constexpr std::size_t chunk_alignment = 4096;
+  // Largest message either side sends or accepts; a header announcing more is rejected before the
+  // receiver allocates anything
+  static constexpr std::size_t max_message_bytes = std::size_t{4} << 30;
+
+  StripedTcpTransport(std::size_t my_id, const MOTION::Communication::tcp_parties_config& config,
+                      std::size_t num_streams, std::size_t buffer_bytes,
+                      std::chrono::milliseconds timeout = std::chrono::seconds(60))
+      : streams_(num_streams) {
+    std::vector<UniqueFd> fds = my_id == 0 ? accept_streams(config[0], num_streams, buffer_bytes, timeout)
+                                           : connect_streams(config[0], num_streams, buffer_bytes, timeout);
+    for (std::size_t i = 0; i < num_streams; ++i) {
+      int one = 1;
+      setsockopt(fds[i].get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      streams_[i].fd = fds[i].release();
+    }
+    for (std::size_t i = 0; i < num_streams; ++i) {
+      streams_[i].writer = std::thread([this, i] { write_loop(streams_[i]); });
+      streams_[i].reader = std::thread([this, i] { read_loop(streams_[i]); });
+    }
+  }
+
+  ~StripedTcpTransport() override {
+    shutdown();
+    for (auto& stream : streams_) {
+      ::shutdown(stream.fd, SHUT_RDWR);  // unblocks a reader whose peer never closed
+    }
+    for (auto& stream : streams_) {
+      stream.reader.join();
+      close(stream.fd);
+    }
+  }
+
+  void send_message(std::vector<std::uint8_t>&& message) override {
+    check_send_error();
+    enqueue(std::make_shared<const std::vector<std::uint8_t>>(std::move(message)));
+  }
+
+  void send_message(const std::vector<std::uint8_t>& message) override {
+    check_send_error();
+    enqueue(std::make_shared<const std::vector<std::uint8_t>>(message));
+  }
+
+  bool available() const override {
+    std::scoped_lock lock(receive_mutex_);
+    auto it = assembling_.find(next_receive_);
+    return it != assembling_.end() && it->second.received == it->second.bytes.size();
+  }
+
+  // Called by the receive thread of the communication layer only
+  std::optional<std::vector<std::uint8_t>> receive_message() override {
+    std::unique_lock lock(receive_mutex_);
+    auto complete = [this] {
+      auto it = assembling_.find(next_receive_);
+      return it != assembling_.end() && it->second.received == it->second.bytes.size();
+    };
+    receive_cv_.wait(lock, [&] { return complete() || closed_streams_ == streams_.size() || link_error_; });
+    if (!complete()) {
+      if (link_error_received_) {
+        std::rethrow_exception(link_error_);
+      }
+      return std::nullopt;
+    }
+    auto node = assembling_.extract(next_receive_++);
+    ++statistics_.num_messages_received;
+    statistics_.num_bytes_received += node.mapped().bytes.size();
+    return std::move(node.mapped().bytes);
+  }
+
+  // Drain the send queues, then close the sending side of every stream
+  void shutdown() override {
+    if (stopped_.exchange(true)) {
+      return;
+    }
+    for (auto& stream : streams_) {
+      {
+        std::scoped_lock lock(stream.mutex);
+        stream.closing = true;
+      }
+      stream.cv.notify_one();
+    }
+    for (auto& stream : streams_) {
+      stream.writer.join();
+      ::shutdown(stream.fd, SHUT_WR);
+    }
+  }
+
+  // Per-stream traffic since the last call
+  std::vector<StreamStatistics> take_statistics() {
+    std::vector<StreamStatistics> result;
+    for (auto& stream : streams_) {
+      std::scoped_lock lock(stream.mutex);
+      result.push_back(stream.statistics);
+      stream.statistics = {};
+    }
+    return result;
+  }
+
+ private:
+  // Owns a socket until release(); closes it if setup fails halfway
+  class UniqueFd {
+   public:
+    UniqueFd() = default;
+    explicit UniqueFd(int fd) : fd_(fd) {}
+    UniqueFd(UniqueFd&& other) noexcept : fd_(other.release()) {}
+    UniqueFd& operator=(UniqueFd&& other) noexcept {
+      if (this != &other) {
+        reset(other.release());
+      }
+      return *this;
+    }
+    ~UniqueFd() { reset(); }
+
+    int get() const { return fd_; }
+    bool valid() const { return fd_ >= 0; }
+    int release() { return std::exchange(fd_, -1); }
+    void reset(int fd = -1) {
+      if (fd_ >= 0) {
+        close(fd_);
+      }
+      fd_ = fd;
+    }
+
+   private:
+    int fd_ = -1;
+  };
+
+  struct ChunkHeader {
+    std::uint64_t sequence;
+    std::uint64_t message_size;
+    std::uint64_t offset;
+    std::uint64_t size;
+  };
+
+  // ChunkHeader on the wire: its four fields as 8-byte little-endian integers
+  static constexpr std::size_t header_bytes = 4 * sizeof(std::uint64_t);
+  using HeaderBytes = std::array<std::uint8_t, header_bytes>;
+
+  struct Chunk {
+    ChunkHeader header;
+    HeaderBytes header_bytes;  // encoded header
+    std::shared_ptr<const std::vector<std::uint8_t>> message;
+  };
+
+  struct Stream {
+    int fd = -1;
+    std::thread writer;
+    std::thread reader;
+    std::mutex mutex;  // queue, closing, statistics
+    std::condition_variable cv;
+    std::deque<Chunk> queue;
+    bool closing = false;
+    StreamStatistics statistics;
+  };
+
+  struct Assembly {
+    std::vector<std::uint8_t> bytes;
+    std::size_t received = 0;
+    bool sized = false;  // bytes has the message size of the first chunk that arrived
+  };
+
+  static void store_le(std::uint8_t* bytes, std::uint64_t value, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      bytes[i] = static_cast<std::uint8_t>(value >> (8 * i));
+    }
+  }
+
+  static std::uint64_t load_le(const std::uint8_t* bytes, std::size_t size) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      value |= static_cast<std::uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  static HeaderBytes encode_header(const ChunkHeader& header) {
+    HeaderBytes bytes;
+    store_le(bytes.data(), header.sequence, 8);
+    store_le(bytes.data() + 8, header.message_size, 8);
+    store_le(bytes.data() + 16, header.offset, 8);
+    store_le(bytes.data() + 24, header.size, 8);
+    return bytes;
+  }
+
+  static ChunkHeader decode_header(const HeaderBytes& bytes) {
+    return {load_le(bytes.data(), 8), load_le(bytes.data() + 8, 8), load_le(bytes.data() + 16, 8),
+            load_le(bytes.data() + 24, 8)};
+  }
+
+  // Buffer sizes have to be set before connect / listen, they fix the window scale of the connection
+  static void set_buffer_sizes(int fd, std::size_t buffer_bytes) {
+    if (buffer_bytes != 0) {
+      int size = static_cast<int>(std::min<std::size_t>(buffer_bytes, std::numeric_limits<int>::max()));
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+  }
+
+  static addrinfo* resolve(const MOTION::Communication::tcp_connection_config& address, bool passive) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* result = nullptr;
+    std::string port = std::to_string(address.port);
+    int error = getaddrinfo(address.host.c_str(), port.c_str(), &hints, &result);
+    if (error != 0) {
+      throw std::runtime_error("cannot resolve " + address.host + ": " + gai_strerror(error));
+    }
+    return result;
+  }
+
+  // Interrupted or (with a send timeout) not yet possible: the send is just tried again
+  static bool retry_send(int error) { return error == EINTR || error == EAGAIN || error == EWOULDBLOCK; }
+
+  static void write_exact(int fd, const void* data, std::size_t size) {
+    auto* bytes = static_cast<const std::uint8_t*>(data);
+    while (size > 0) {
+      ssize_t n = ::send(fd, bytes, size, MSG_NOSIGNAL);
+      if (n < 0 && retry_send(errno)) {
+        continue;
+      }
+      if (n <= 0) {
+        throw std::system_error(errno, std::generic_category(), "striped TCP send");
+      }
+      bytes += n;
+      size -= static_cast<std::size_t>(n);
+    }
+  }
+
+  // false on end of stream before the first byte
+  static bool read_exact(int fd, void* data, std::size_t size) {
+    auto* bytes = static_cast<std::uint8_t*>(data);
+    std::size_t done = 0;
+    while (done < size) {
+      ssize_t n = ::recv(fd, bytes + done, size - done, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n == 0 && done == 0) {
+        return false;
+      }
+      if (n <= 0) {
+        throw std::runtime_error("striped TCP stream closed inside a chunk");
+      }
+      done += static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  // Party 0: accept the streams in any order, each announces its index first
+  static std::vector<UniqueFd> accept_streams(const MOTION::Communication::tcp_connection_config& address,
+                                              std::size_t num_streams, std::size_t buffer_bytes,
+                                              std::chrono::milliseconds timeout) {
+    addrinfo* info = resolve(address, true);
+    UniqueFd listener(socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+    if (listener.valid()) {
+      int one = 1;
+      setsockopt(listener.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      set_buffer_sizes(listener.get(), buffer_bytes);  // inherited by the accepted sockets
+    }
+    if (!listener.valid() || bind(listener.get(), info->ai_addr, info->ai_addrlen) != 0 ||
+        listen(listener.get(), static_cast<int>(num_streams)) != 0) {
+      int error = errno;
+      freeaddrinfo(info);
+      throw std::system_error(error, std::generic_category(), "cannot listen on port " + std::to_string(address.port));
+    }
+    freeaddrinfo(info);
+
+    timeval tv{static_cast<time_t>(timeout.count() / 1000), static_cast<suseconds_t>(timeout.count() % 1000 * 1000)};
+    setsockopt(listener.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::vector<UniqueFd> fds(num_streams);
+    for (std::size_t accepted = 0; accepted < num_streams;) {
+      UniqueFd fd(accept(listener.get(), nullptr, nullptr));
+      if (!fd.valid() && errno == EINTR) {
+        continue;
+      }
+      if (!fd.valid()) {
+        throw std::system_error(errno, std::generic_category(), "waiting for striped TCP streams of party 1");
+      }
+      // Hello: stream index and stream count, 4-byte little endian each
+      std::uint8_t hello_bytes[8];
+      bool announced = read_exact(fd.get(), hello_bytes, sizeof(hello_bytes));
+      std::uint64_t index = load_le(hello_bytes, 4);
+      std::uint64_t count = load_le(hello_bytes + 4, 4);
+      if (!announced || count != num_streams || index >= num_streams || fds[index].valid()) {
+        throw std::runtime_error("party 1 announced a different number of TCP streams");
+      }
+      fds[index] = std::move(fd);
+      ++accepted;
+    }
+    return fds;
+  }
+
+  // Party 1: connect every stream to party 0, retrying until it listens
+  static std::vector<UniqueFd> connect_streams(const MOTION::Communication::tcp_connection_config& address,
+                                               std::size_t num_streams, std::size_t buffer_bytes,
+                                               std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<UniqueFd> fds;
+    for (std::uint32_t index = 0; index < num_streams; ++index) {
+      UniqueFd fd;
+      while (!fd.valid()) {
+        addrinfo* info = resolve(address, false);
+        fd.reset(socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+        if (fd.valid()) {
+          set_buffer_sizes(fd.get(), buffer_bytes);
+        }
+        if (fd.valid() && connect(fd.get(), info->ai_addr, info->ai_addrlen) != 0) {
+          fd.reset();
+        }
+        freeaddrinfo(info);
+        if (!fd.valid()) {
+          if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error("cannot connect to party 0 at " + address.host + ":" +
+                                     std::to_string(address.port));
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+      }
+      std::uint8_t hello[8];
+      store_le(hello, index, 4);
+      store_le(hello + 4, num_streams, 4);
+      write_exact(fd.get(), hello, sizeof(hello));
+      fds.push_back(std::move(fd));
+    }
+    return fds;
+  }
+
+  void enqueue(std::shared_ptr<const std::vector<std::uint8_t>> message) {
+    std::size_t size = message->size();
+    if (size > max_message_bytes) {
+      throw std::length_error("message too large for the striped TCP transport");
+    }
+    std::scoped_lock lock(send_mutex_);
+    std::uint64_t sequence = next_send_++;
+    ++statistics_.num_messages_sent;
+    statistics_.num_bytes_sent += size;
+
+    std::size_t num_chunks = size < stripe_bytes ? 1 : streams_.size();
+    std::size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+    chunk_size = (chunk_size + chunk_alignment - 1) / chunk_alignment * chunk_alignment;
+    for (std::size_t i = 0, offset = 0; i < num_chunks && (offset < size || i == 0); ++i, offset += chunk_size) {
+      ChunkHeader header{sequence, size, offset, std::min(chunk_size, size - offset)};
+      Chunk chunk{header, encode_header(header), message};
+      auto& stream = streams_[i];
+      {
+        std::scoped_lock stream_lock(stream.mutex);
+        stream.queue.push_back(std::move(chunk));
+      }
+      stream.cv.notify_one();
+    }
+  }
+
+  void write_loop(Stream& stream) {
+    while (true) {
+      Chunk chunk;
+      {
+        std::unique_lock lock(stream.mutex);
+        stream.cv.wait(lock, [&] { return !stream.queue.empty() || stream.closing; });
+        if (stream.queue.empty()) {
+          return;
+        }
+        chunk = std::move(stream.queue.front());
+        stream.queue.pop_front();
+      }
+      iovec parts[2] = {{chunk.header_bytes.data(), header_bytes},
+                        {const_cast<std::uint8_t*>(chunk.message->data() + chunk.header.offset), chunk.header.size}};
+      msghdr msg{};
+      msg.msg_iov = parts;
+      msg.msg_iovlen = 2;
+      try {
+        // One sendmsg for header and payload, the remainder (if any) with plain sends
+        ssize_t sent;
+        do {
+          sent = sendmsg(stream.fd, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && retry_send(errno));
+        if (sent < 0) {
+          throw std::system_error(errno, std::generic_category(), "striped TCP send");
+        }
+        std::size_t done = static_cast<std::size_t>(sent);
+        if (done < header_bytes) {
+          write_exact(stream.fd, chunk.header_bytes.data() + done, header_bytes - done);
+          done = header_bytes;
+        }
+        write_exact(stream.fd, chunk.message->data() + chunk.header.offset + (done - header_bytes),
+                    chunk.header.size - (done - header_bytes));
+      } catch (...) {
+        fail_link(stream, std::current_exception(), false);
+        return;
+      }
+      std::scoped_lock lock(stream.mutex);
+      ++stream.statistics.chunks_sent;
+      stream.statistics.bytes_sent += header_bytes + chunk.header.size;
+    }
+  }
+
+  // The first send or receive error: later sends rethrow it, receivers stop waiting for the peer (and
+  // rethrow it if it came from a reader)
+  void fail_link(Stream& stream, std::exception_ptr error, bool receiving) {
+    {
+      std::scoped_lock lock(receive_mutex_);
+      if (!link_error_) {
+        link_error_ = error;
+        link_error_received_ = receiving;
+      }
+    }
+    link_failed_ = true;
+    {
+      std::scoped_lock lock(stream.mutex);
+      stream.queue.clear();
+    }
+    ::shutdown(stream.fd, SHUT_RDWR);  // the peer sees the broken stream instead of a stalled one
+    receive_cv_.notify_all();
+  }
+
+  void check_send_error() const {
+    if (link_failed_) {
+      std::scoped_lock lock(receive_mutex_);
+      std::rethrow_exception(link_error_);
+    }
+  }
+
+  void read_loop(Stream& stream) {
+    try {
+      HeaderBytes encoded;
+      while (read_exact(stream.fd, encoded.data(), encoded.size())) {
+        ChunkHeader header = decode_header(encoded);
+        if (header.message_size > max_message_bytes) {
+          throw std::length_error("striped TCP chunk announces a message of " + std::to_string(header.message_size) +
+                                  " bytes");
+        }
+        if (header.size > header.message_size || header.offset > header.message_size - header.size) {
+          throw std::runtime_error("striped TCP chunk outside its message");
+        }
+        // The entry stays in place until this chunk is counted: it is only taken once complete
+        Assembly* assembly;
+        {
+          std::scoped_lock lock(receive_mutex_);
+          if (header.sequence < next_receive_) {
+            throw std::runtime_error("striped TCP chunk of an already delivered message");
+          }
+          assembly = &assembling_[header.sequence];
+          if (!assembly->sized) {
+            assembly->bytes.resize(header.message_size);  // first chunk to arrive
+            assembly->sized = true;
+          } else if (assembly->bytes.size() != header.message_size) {
+            throw std::runtime_error("striped TCP chunks disagree on the message size");
+          }
+        }
+        if (header.size != 0) {
+          if (!read_exact(stream.fd, assembly->bytes.data() + header.offset, header.size)) {
+            throw std::runtime_error("striped TCP stream closed inside a chunk");
+          }
+          std::scoped_lock lock(receive_mutex_);
+          assembly->received += header.size;
+        }
+        receive_cv_.notify_one();
+        std::scoped_lock lock(stream.mutex);
+        ++stream.statistics.chunks_received;
+        stream.statistics.bytes_received += header_bytes + header.size;
+      }
+    } catch (...) {
+      // A malformed chunk or a broken stream breaks the whole link: messages that are incomplete
+      // never complete, so the receiver must not wait for the remaining streams
+      fail_link(stream, std::current_exception(), true);
+    }
+    {
+      std::scoped_lock lock(receive_mutex_);
+      ++closed_streams_;
+    }
+    receive_cv_.notify_one();
+  }
+
+  std::vector<Stream> streams_;
+  std::mutex send_mutex_;  // next_send_ and the chunk order across the stream queues
+  std::uint64_t next_send_ = 0;
+  std::atomic<bool> stopped_{false};
+
+  mutable std::mutex receive_mutex_;  // assembling_, next_receive_, closed_streams_, link_error_
+  std::condition_variable receive_cv_;
+  std::map<std::uint64_t, Assembly> assembling_;
+  std::uint64_t next_receive_ = 0;
+  std::size_t closed_streams_ = 0;
+  std::exception_ptr link_error_;
+  bool link_error_received_ = false;      // link_error_ came from a reader
+  std::atomic<bool> link_failed_{false};  // set once link_error_ is
+};
+
+// Transport statistics beyond the totals of the communication layer, summed over repetitions
+struct SessionStatistics {
+  std::optional<CoalescingStatistics> coalescing;  // with --coalesce-bytes
+  std::vector<StreamStatistics> streams;           // one per socket of a striped TCP link
+};
+
+// The connection of a session, with its coalescing layer if --coalesce-bytes is set
+struct CommunicationSession {
+  std::unique_ptr<MOTION::Communication::CommunicationLayer> comm_layer;
+  std::vector<CoalescingTransport*> coalescing;  // owned by comm_layer
+  StripedTcpTransport* striped = nullptr;        // owned by comm_layer, with more than one TCP stream
+
+  // Add the traffic since the last call to `stats`
+  void take_statistics(SessionStatistics& stats) {
+    if (!coalescing.empty()) {
+      if (!stats.coalescing.has_value()) {
+        stats.coalescing.emplace();
+      }
+      for (auto* transport : coalescing) {
+        stats.coalescing->add(transport->take_statistics());
+      }
+    }
+    if (striped != nullptr) {
+      auto streams = striped->take_statistics();
+      stats.streams.resize(streams.size());
+      for (std::size_t i = 0; i < streams.size(); ++i) {
+        stats.streams[i].add(streams[i]);
+      }
+    }
+  }
+};
+
+CommunicationSession setup_communication(const Options& options) {
+  CommunicationSession session;
+  std::vector<std::unique_ptr<MOTION::Communication::Transport>> transports;
+  if (!options.shm_name.empty()) {
+    transports.resize(2);
+    transports[1 - options.my_id] = std::make_unique<ShmTransport>(options.shm_name, options.my_id);
+  } else if (options.tcp_streams > 1) {
+    transports.resize(2);
+    auto striped = std::make_unique<StripedTcpTransport>(options.my_id, options.tcp_config, options.tcp_streams,
+                                                         options.tcp_buffer_bytes);
+    session.striped = striped.get();
+    transports[1 - options.my_id] = std::move(striped);
+  } else {
+    MOTION::Communication::TCPSetupHelper helper(options.my_id, options.tcp_config);
+    transports = helper.setup_connections();
+  }
+  if (options.coalesce_bytes != 0) {
+    for (auto& transport : transports) {
+      if (!transport) {
+        continue;  // no connection to ourselves
+      }
+      auto coalescing = std::make_unique<CoalescingTransport>(
+          std::move(transport), options.coalesce_bytes, std::chrono::microseconds(options.coalesce_delay_us));
+      session.coalescing.push_back(coalescing.get());
+      transport = std::move(coalescing);
+    }
+  }
+  session.comm_layer =
+      std::make_unique<MOTION::Communication::CommunicationLayer>(options.my_id, std::move(transports));
+  return session;
+}
+
+std::vector<uint64_t> convert_to_binary(uint64_t x) {
+    std::vector<uint64_t> res;
+    for (uint64_t i = 0; i < 64; ++i) {
+        if (x%2 == 1) res.push_back(1);
+        else res.push_back(0);
+        x /= 2;
+    }
+    return res;
+}
+
+
+// Host-side parallelism for the local stages (input gathering, differences, hashing) over --threads
+// Only work on plain buffers goes through here: gates are still created on the calling thread in a
+// fixed order, so both parties assign the same gate IDs
+namespace HostParallel {
+
+  // Items per claimed block; large enough that claiming is negligible next to the work
+  constexpr size_t default_grain = 4096;
+
+  // Run fn(begin, end) over [0, count) in blocks of `grain` items, claimed dynamically from a shared
+  // counter by up to `num_threads` threads (the caller is one of them), so slower blocks balance out
+  // num_threads == 0 uses one thread per hardware thread, as --threads 0 does for the backend
+  // Every item is covered by exactly one call; calls must write disjoint outputs
+  // The first exception thrown by a block is rethrown after all threads have finished
+  void parallel_for(size_t num_threads, size_t count, size_t grain,
+                    const std::function<void(size_t, size_t)>& fn) {
+    size_t num_blocks = (count + grain - 1) / grain;
+    if (num_threads == 0) {
+      num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    size_t workers = std::min(num_threads, num_blocks);
+    if (workers <= 1) {
+      if (count != 0) {
+        fn(0, count);
+      }
+      return;
+    }
+
+    std::atomic<size_t> next_block{0};
+    auto worker = [&] {
+      for (size_t block = next_block++; block < num_blocks; block = next_block++) {
+        fn(block * grain, std::min(count, (block + 1) * grain));
+      }
+    };
+    std::vector<std::future<void>> helpers;
+    helpers.reserve(workers - 1);
+    for (size_t i = 1; i < workers; ++i) {
+      helpers.push_back(std::async(std::launch::async, worker));
+    }
+
+    std::exception_ptr error;
+    try {
+      worker();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    for (auto& helper : helpers) {
+      try {
+        helper.get();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+
+// Fixed-key AES-128 hash behind --mode hash
+// Output block j of input block x is H_j(x) = AES_K(x ^ j) ^ x ^ j (j XORed into byte 0) under a fixed
+// public key K; with AES_K modelled as a random permutation, two different inputs give the same
+// output block with probability about 2^-128
+// With AES-NI (__AES__) blocks go through the rounds 8 at a time: each round key is loaded once and
+// applied to 8 independent states, so every aesenc overlaps with the latency of the others. The
+// portable path computes the same function byte-wise, so builds with and without AES-NI agree
+namespace FixedKeyAES {
+
+  constexpr size_t block_size = 16;
+  constexpr size_t num_rounds = 10;
+  constexpr size_t lanes = 8;  // independent blocks in flight per round
+
+  using Block = std::array<uint8_t, block_size>;
+  using RoundKeys = std::array<Block, num_rounds + 1>;
+
+  // First 128 bits of the fractional part of pi
+  constexpr Block key = {0x24, 0x3f, 0x6a, 0x88, 0x85, 0xa3, 0x08, 0xd3,
+                         0x13, 0x19, 0x8a, 0x2e, 0x03, 0x70, 0x73, 0x44};
+
+  constexpr std::array<uint8_t, 256> sbox = {
+      0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+      0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+      0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+      0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+      0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+      0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+      0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+      0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+      0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+      0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+      0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+      0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+      0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+      0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+      0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+      0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+  };
+
+  uint8_t xtime(uint8_t x) { return static_cast<uint8_t>((x << 1) ^ ((x >> 7) * 0x1b)); }
+
+  // AES-128 key expansion (FIPS-197, 5.2); both paths use the same schedule
+  RoundKeys expand_key(const Block& cipher_key) {
+    RoundKeys keys{};
+    keys[0] = cipher_key;
+    uint8_t rcon = 1;
+    for (size_t round = 1; round <= num_rounds; ++round) {
+      const Block& prev = keys[round - 1];
+      Block& next = keys[round];
+      // SubWord(RotWord(last word)) ^ rcon
+      uint8_t temp[4] = {static_cast<uint8_t>(sbox[prev[13]] ^ rcon), sbox[prev[14]], sbox[prev[15]], sbox[prev[12]]};
+      for (size_t i = 0; i < block_size; ++i) {
+        next[i] = prev[i] ^ (i < 4 ? temp[i] : next[i - 4]);
+      }
+      rcon = xtime(rcon);
+    }
+    return keys;
+  }
+
+  // Expanded once per process
+  const RoundKeys& round_keys() {
+    static const RoundKeys keys = expand_key(key);
+    return keys;
+  }
+
+  // One AES-128 encryption of `state` in place, byte-wise (state is column-major as in FIPS-197)
+  void encrypt_portable(const RoundKeys& keys, Block& state) {
+    for (size_t i = 0; i < block_size; ++i) {
+      state[i] ^= keys[0][i];
+    }
+    for (size_t round = 1; round <= num_rounds; ++round) {
+      // SubBytes and ShiftRows: row r of column c is taken from column c + r
+      Block next;
+      for (size_t c = 0; c < 4; ++c) {
+        for (size_t r = 0; r < 4; ++r) {
+          next[4 * c + r] = sbox[state[4 * ((c + r) % 4) + r]];
+        }
+      }
+      if (round != num_rounds) {
+        for (size_t c = 0; c < 4; ++c) {
+          uint8_t* column = next.data() + 4 * c;
+          uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+          uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+          column[0] = a0 ^ all ^ xtime(a0 ^ a1);
+          column[1] = a1 ^ all ^ xtime(a1 ^ a2);
+          column[2] = a2 ^ all ^ xtime(a2 ^ a3);
+          column[3] = a3 ^ all ^ xtime(a3 ^ a0);
+        }
+      }
+      for (size_t i = 0; i < block_size; ++i) {
+        state[i] = next[i] ^ keys[round][i];
+      }
+    }
+  }
+
+#if defined(__AES__)
+  // Middle rounds over the lanes; the fold emits the `lanes` independent aesenc of a round back to back
+  template <size_t... L>
+  void middle_rounds(__m128i* state, const __m128i* round_key, std::index_sequence<L...>) {
+    for (size_t round = 1; round < num_rounds; ++round) {
+      ((state[L] = _mm_aesenc_si128(state[L], round_key[round])), ...);
+    }
+  }
+#endif
+
+  // Hash `num_blocks` 16-byte blocks stored back to back in `inputs` into `num_blocks` outputs of
+  // `output_size` bytes stored back to back in `outputs` (output blocks H_0, H_1, ..., the last one
+  // cut to size). `outputs` may alias `inputs` when output_size == 16: every group of lanes is read
+  // before any of it is written
+  void hash(const uint8_t* inputs, uint8_t* outputs, size_t num_blocks, size_t output_size) {
+    const size_t out_blocks = (output_size + block_size - 1) / block_size;
+    const size_t num_items = num_blocks * out_blocks;  // item = (input block, output block j)
+    const RoundKeys& keys = round_keys();
+
+    auto store = [&](size_t item, const uint8_t* image) {
+      size_t offset = (item % out_blocks) * block_size;
+      std::memcpy(outputs + (item / out_blocks) * output_size + offset, image,
+                  std::min(block_size, output_size - offset));
+    };
+
+    size_t item = 0;
+#if defined(__AES__)
+    __m128i round_key[num_rounds + 1];
+    for (size_t round = 0; round <= num_rounds; ++round) {
+      round_key[round] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys[round].data()));
+    }
+    for (; item + lanes <= num_items; item += lanes) {
+      __m128i x[lanes];
+      __m128i state[lanes];
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        size_t current = item + lane;
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inputs + (current / out_blocks) * block_size));
+        x[lane] = _mm_xor_si128(input, _mm_cvtsi32_si128(static_cast<int>(current % out_blocks)));
+        state[lane] = _mm_xor_si128(x[lane], round_key[0]);
+      }
+      middle_rounds(state, round_key, std::make_index_sequence<lanes>{});
+      Block image;
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        state[lane] = _mm_xor_si128(_mm_aesenclast_si128(state[lane], round_key[num_rounds]), x[lane]);
+      }
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(image.data()), state[lane]);
+        store(item + lane, image.data());
+      }
+    }
+#endif
+    // Portable path, and the last < 8 items with AES-NI
+    for (; item < num_items; ++item) {
+      Block x;
+      std::memcpy(x.data(), inputs + (item / out_blocks) * block_size, block_size);
+      x[0] ^= static_cast<uint8_t>(item % out_blocks);
+      Block image = x;
+      encrypt_portable(keys, image);
+      for (size_t i = 0; i < block_size; ++i) {
+        image[i] ^= x[i];
+      }
+      store(item, image.data());
+    }
+  }
+}
+
+
+// String processing namespace for pattern matching functionality
+namespace StringProcessing {
+    
+  // Convert string to vector of uint8_t values (ASCII)
+  std::vector<uint8_t> string_to_integers(const std::string& str) {
+    return std::vector<uint8_t>(str.begin(), str.end());
+  }
+
+  // Non-owning view of one sliding window: `length` consecutive bytes starting at `data`
+  struct WindowView {
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+
+    uint8_t operator[](size_t pos) const { return data[pos]; }
+    size_t size() const { return length; }
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + length; }
+  };
+
+  // Strided, non-owning view of all sliding windows over one contiguous uint8_t buffer
+  // Window w covers base[w * stride, w * stride + window_size)
+  // - stride == 1: overlapping windows directly over the text (no per-window storage at all)
+  // - stride == window_size: windows stored back to back, e.g. shares gathered per window
+  // Example: text="HELLO", window_size=3, stride=1 -> views "HEL", "ELL", "LLO" over the same 5 bytes
+  struct SlidingWindows {
+    const uint8_t* base = nullptr;
+    size_t num_windows = 0;
+    size_t window_size = 0;
+    size_t stride = 1;
+
+    WindowView operator[](size_t window) const { return {base + window * stride, window_size}; }
+    size_t size() const { return num_windows; }
+  };
+  
+  // Break pattern into individual characters
+  // Example: "HEL" -> ["H", "E", "L"]
+  std::vector<std::string> break_pattern_into_chars(const std::string& pattern) {
+    std::vector<std::string> result;
+    for (char c : pattern) {
+      result.push_back(std::string(1, c));
+    }
+    return result;
+  }
+  
+  // Create sliding windows over text bytes
+  // Example: text="HELLO", pattern_size=3 -> views ["H","E","L"], ["E","L","L"], ["L","L","O"]
+  // The returned view points into `text`, which must outlive it
+  SlidingWindows create_sliding_windows(const std::vector<uint8_t>& text, size_t pattern_size) {
+    if (text.size() < pattern_size) {
+      return {text.data(), 0, pattern_size, 1}; // No windows if text is shorter than pattern
+    }
+    return {text.data(), text.size() - pattern_size + 1, pattern_size, 1};
+  }
+  
+  // Convert pattern characters to uint8_t values for secret sharing
+  std::vector<uint8_t> pattern_chars_to_integers(const std::vector<std::string>& pattern_chars) {
+    std::vector<uint8_t> result;
+    for (const auto& char_str : pattern_chars) {
+      if (!char_str.empty()) {
+        result.push_back(static_cast<uint8_t>(char_str[0]));
+      }
+    }
+    return result;
+  }
+
+  // Print pattern breakdown for debugging
+  template <typename T>
+  void print_vector(const std::vector<T>& input_vector) {
+    std::cout << "[";
+    for (size_t i = 0; i < input_vector.size(); ++i) {
+      std::cout << "\"" << input_vector[i] << "\"";
+      if (i < input_vector.size() - 1) std::cout << ", ";
+    }
+    std::cout << "]" << std::endl;
+  }
+  
+  // Print sliding windows for debugging, either as characters or as ASCII values
+  void print_sliding_windows(const SlidingWindows& windows, bool as_chars) {
+    std::cout << "[";
+    for (size_t i = 0; i < windows.size(); ++i) {
+        const WindowView window = windows[i];
+        std::cout << "[";
+        for (size_t j = 0; j < window.size(); ++j) {
+            std::cout << "\"";
+            if (as_chars) std::cout << static_cast<char>(window[j]);
+            else std::cout << (int)window[j];
+            std::cout << "\"";
+            if (j < window.size() - 1) std::cout << ", ";
+        }
+        std::cout << "]";
+    }
+    std::cout << "]" << std::endl;
+  }
+
+  // Concat a vector (or view) of integers into string
+  template <typename Container>
+  std::string concat_vector(const Container& target_vector) {
+    std::string final_result {};
+
+    for (auto el : target_vector) {
+      final_result += std::to_string(el);
+    }
+
+    return final_result;
+  }
+
+  constexpr size_t hash_input_size = 16;  // AES requires exactly 16 bytes input
+  constexpr size_t hash_size = 32;        // widest output (256 bits), --fingerprint-bits selects a prefix
+
+  // Flat storage for the hashes of all windows
+  // Hash of window w occupies bytes[w * hash_size, (w + 1) * hash_size)
+  struct WindowHashes {
+    size_t num_windows = 0;
+    size_t hash_size = 0;
+    std::vector<uint8_t> bytes;
+
+    WindowView operator[](size_t window) const { return {bytes.data() + window * hash_size, hash_size}; }
+    size_t size() const { return num_windows; }
+  };
+
+  // XOR bytes [offset, offset + 16) of a difference window into a 16-byte block, zero padded past the
+  // end of the window
+  void xor_difference_block(const WindowView& differences, size_t offset, uint8_t* block) {
+    size_t block_size = std::min(hash_input_size, differences.size() - offset);
+    for (size_t i = 0; i < block_size; ++i) {
+      block[i] ^= differences[offset + i];
+    }
+  }
+
+  // Fixed-key AES calls the chain spends on a window of `window_size` bytes (see hash_difference_windows)
+  constexpr size_t chain_steps(size_t window_size) {
+    return window_size <= hash_input_size ? 0 : (window_size - 1) / hash_input_size;
+  }
+
+  // Hash every window of `difference_windows` into `hashes` of `output_size` bytes each
+  // Each window is chained into one 16-byte block: the first 16 bytes are copied (zero padded if
+  // shorter) and every further 16-byte block is XORed into H_0 of the chain so far (CBC-MAC style,
+  // windows have a fixed length); the block is then hashed to `output_size` bytes. Two different
+  // windows only end in the same hash through an AES hash collision; a plain XOR fold would not do,
+  // since the differences are arithmetic shares and x + 128 == x ^ 128 (mod 256) makes bytes 16 apart
+  // cancel
+  // The chain runs in lockstep over a thread's block of windows, so every step and the final hash
+  // are one FixedKeyAES::hash call over contiguous blocks of `input_blocks` (8 AES pipelines per
+  // round with AES-NI); both buffers are resized, so reused buffers keep their allocation
+  // M != 0 fixes the window length at compile time
+  template <size_t M = 0>
+  void hash_difference_windows(const SlidingWindows& difference_windows, WindowHashes& hashes,
+                               std::vector<uint8_t>& input_blocks, size_t output_size = hash_size,
+                               size_t num_threads = 1) {
+    hashes.num_windows = difference_windows.size();
+    hashes.hash_size = output_size;
+    hashes.bytes.resize(hashes.num_windows * output_size);
+
+    const size_t window_size = M == 0 ? difference_windows.window_size : M;
+    input_blocks.resize(hashes.num_windows * hash_input_size);
+    HostParallel::parallel_for(num_threads, hashes.num_windows, HostParallel::default_grain,
+                               [&](size_t begin, size_t end) {
+      uint8_t* blocks = input_blocks.data() + begin * hash_input_size;
+      size_t count = end - begin;
+      std::fill(blocks, blocks + count * hash_input_size, 0);
+      for (size_t window = begin; window < end; ++window) {
+        xor_difference_block(difference_windows[window], 0, input_blocks.data() + window * hash_input_size);
+      }
+      for (size_t offset = hash_input_size; offset < window_size; offset += hash_input_size) {
+        FixedKeyAES::hash(blocks, blocks, count, hash_input_size);
+        for (size_t window = begin; window < end; ++window) {
+          xor_difference_block(difference_windows[window], offset, input_blocks.data() + window * hash_input_size);
+        }
+      }
+      FixedKeyAES::hash(blocks, hashes.bytes.data() + begin * output_size, count, output_size);
+    });
+  }
+
+  // Word `word_pos` (bytes [word_pos * sizeof(T), (word_pos + 1) * sizeof(T)), little endian) of every
+  // window hash, in window order (input of one Phase 2 SIMD plane)
+  template <typename T>
+  std::vector<T> hash_word_plane(const WindowHashes& hashes, size_t word_pos, size_t num_threads = 1) {
+    std::vector<T> plane(hashes.size());
+    HostParallel::parallel_for(num_threads, hashes.size(), HostParallel::default_grain,
+                               [&](size_t begin, size_t end) {
+      for (size_t window = begin; window < end; ++window) {
+        const uint8_t* word_bytes = hashes[window].data + word_pos * sizeof(T);
+        T word = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+          word |= static_cast<T>(word_bytes[i]) << (8 * i);
+        }
+        plane[window] = word;
+      }
+    });
+    return plane;
+  }
+
+  // String processing for pattern holder; `verbose` dumps the characters and their ASCII values
+  auto pattern_holder(const std::string& pattern, bool verbose) {
+    std::vector<std::string> pattern_vector = break_pattern_into_chars(pattern);
+    std::vector<uint8_t> pattern_ascii_vector = pattern_chars_to_integers(pattern_vector);
+    if (verbose) {
+      std::cout << "Pattern: \"" << pattern << "\"" << std::endl;
+      std:: cout << "Broken down to Char: \n";
+      print_vector(pattern_vector);
+      std:: cout << "Broken down to ASCII: \n";
+      print_vector(pattern_ascii_vector);
+    }
+
+    return pattern_ascii_vector;
+  }
+
+  // String processing for text holder
+  // Returns the text as one contiguous ASCII buffer (O(n)); windows are views created on top of it
+  // `verbose` dumps every window as characters and as ASCII values
+  auto text_holder(const std::string& text, size_t pattern_size, bool verbose) {
+    std::vector<uint8_t> text_ascii_vector = string_to_integers(text);
+    if (verbose) {
+      std::cout << "Original text: \"" << text << "\", pattern_size: " << pattern_size << std::endl;
+      SlidingWindows text_windows = create_sliding_windows(text_ascii_vector, pattern_size);
+      std:: cout << "Broken down to Char: \n";
+      print_sliding_windows(text_windows, true);
+      std:: cout << "Broken down to ASCII: \n";
+      print_sliding_windows(text_windows, false);
+    }
+
+    return text_ascii_vector;
+  }
+}
+
+
+
+// Local (non-interactive) kernels working directly on contiguous share buffers
+namespace ShareKernels {
+
+  // Typed, read-only view of the shares held on one arithmetic GMW wire
+  template <typename T>
+  struct ShareSpan {
+    const T* data = nullptr;
+    size_t size = 0;
+
+    const T& operator[](size_t i) const { return data[i]; }
+  };
+
+  // Cast-free accessor: wires[0] must be an ArithmeticGMWWire<T> (as produced by the arithmetic GMW
+  // input gates); the returned span stays valid as long as the wire is alive
+  template <typename T>
+  ShareSpan<T> get_share_span(const std::shared_ptr<MOTION::NewWire>& wire) {
+    const auto& share = std::static_pointer_cast<ArithmeticGMWWire<T>>(wire)->get_share();
+    return {share.data(), share.size()};
+  }
+
+  template <typename T>
+  ShareSpan<T> get_share_span(const MOTION::WireVector& wires) {
+    return get_share_span<T>(wires[0]);
+  }
+
+  // Share difference for one window row: out[pos] = t[pos] - p[pos], or p[pos] - t[pos] = -(t[pos] - p[pos])
+  template <bool Negate>
+  void difference_row(const uint8_t* t, const uint8_t* p, uint8_t* out, size_t length) {
+    size_t pos = 0;
+#if defined(__AVX512BW__)
+    for (; pos + 64 <= length; pos += 64) {
+      __m512i tv = _mm512_loadu_si512(reinterpret_cast<const void*>(t + pos));
+      __m512i pv = _mm512_loadu_si512(reinterpret_cast<const void*>(p + pos));
+      __m512i dv = Negate ? _mm512_sub_epi8(pv, tv) : _mm512_sub_epi8(tv, pv);
+      _mm512_storeu_si512(reinterpret_cast<void*>(out + pos), dv);
+    }
+#endif
+#if defined(__AVX2__)
+    for (; pos + 32 <= length; pos += 32) {
+      __m256i tv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + pos));
+      __m256i pv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + pos));
+      __m256i dv = Negate ? _mm256_sub_epi8(pv, tv) : _mm256_sub_epi8(tv, pv);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + pos), dv);
+    }
+#endif
+    // Scalar fallback and tail (arithmetic is mod 2^8, matching ArithmeticGMWWire<uint8_t>)
+    for (; pos < length; ++pos) {
+      out[pos] = Negate ? static_cast<uint8_t>(p[pos] - t[pos]) : static_cast<uint8_t>(t[pos] - p[pos]);
+    }
+  }
+
+  // Compute the share differences of all windows in one pass
+  // out[w * m + pos] = text_windows[w][pos] - pattern[pos]   (negated when `negate` is set)
+  // `out` must hold text_windows.size() * text_windows.window_size bytes
+  void compute_window_differences(const StringProcessing::SlidingWindows& text_windows,
+                                  const uint8_t* pattern, bool negate, uint8_t* out) {
+    const size_t m = text_windows.window_size;
+    for (size_t window = 0; window < text_windows.size(); ++window) {
+      const uint8_t* t = text_windows.base + window * text_windows.stride;
+      if (negate) {
+        difference_row<true>(t, pattern, out + window * m, m);
+      } else {
+        difference_row<false>(t, pattern, out + window * m, m);
+      }
+    }
+  }
+
+  // Rows of compute_window_differences for windows of exactly M bytes: the pattern shares sit in a
+  // std::array and the row loop has a compile-time trip count, so it is unrolled/vectorized as a whole
+  template <size_t M, bool Negate>
+  void difference_rows_fixed(const StringProcessing::SlidingWindows& text_windows, const std::array<uint8_t, M>& p,
+                             uint8_t* out) {
+    for (size_t window = 0; window < text_windows.size(); ++window) {
+      const uint8_t* t = text_windows.base + window * text_windows.stride;
+      uint8_t* row = out + window * M;
+      for (size_t pos = 0; pos < M; ++pos) {
+        row[pos] = Negate ? static_cast<uint8_t>(p[pos] - t[pos]) : static_cast<uint8_t>(t[pos] - p[pos]);
+      }
+    }
+  }
+
+  // compute_window_differences specialized for pattern length M (M == 0: run-time length)
+  template <size_t M>
+  void compute_window_differences_fixed(const StringProcessing::SlidingWindows& text_windows,
+                                        const uint8_t* pattern, bool negate, uint8_t* out) {
+    if constexpr (M == 0) {
+      compute_window_differences(text_windows, pattern, negate, out);
+    } else {
+      std::array<uint8_t, M> p;
+      std::copy(pattern, pattern + M, p.begin());
+      if (negate) {
+        difference_rows_fixed<M, true>(text_windows, p, out);
+      } else {
+        difference_rows_fixed<M, false>(text_windows, p, out);
+      }
+    }
+  }
+
+  // Call kernel(std::integral_constant<size_t, M>{}) with M = pattern_size for the specialized
+  // lengths 4, 8, 16, 32 and 64 (the bulk of the queries), M = 0 for every other length
+  template <typename Kernel>
+  auto dispatch_pattern_size(size_t pattern_size, Kernel&& kernel) {
+    switch (pattern_size) {
+      case 4: return kernel(std::integral_constant<size_t, 4>{});
+      case 8: return kernel(std::integral_constant<size_t, 8>{});
+      case 16: return kernel(std::integral_constant<size_t, 16>{});
+      case 32: return kernel(std::integral_constant<size_t, 32>{});
+      case 64: return kernel(std::integral_constant<size_t, 64>{});
+      default: return kernel(std::integral_constant<size_t, 0>{});
+    }
+  }
+}
+
+
+
+// Flat rows x cols table of gate outputs: one contiguous array of wire pointers
+// instead of one heap-allocated WireVector per entry, so per-scalar gates (e.g. the per-window text
+// inputs) cost one pointer each in the table. Every entry holds the same number of wires (the
+// width of the gate outputs stored in it, fixed by the first set()); destroying the table releases
+// all of its references with one deallocation
+class WireTable {
+ public:
+  WireTable() = default;
+  WireTable(std::size_t rows, std::size_t cols) : rows_(rows), cols_(cols) {}
+
+  std::size_t rows() const { return rows_; }
+  std::size_t cols() const { return cols_; }
+  std::size_t size() const { return rows_ * cols_; }
+  bool empty() const { return wires_.empty(); }
+
+  void set(std::size_t row, std::size_t col, const MOTION::WireVector& wires) {
+    if (width_ == 0) {
+      width_ = wires.size();
+      wires_.resize(size() * width_);
+    } else if (wires.size() != width_) {
+      throw std::invalid_argument("WireTable entries must all have the same number of wires");
+    }
+    std::copy(wires.begin(), wires.end(), wires_.begin() + index(row, col));
+  }
+
+  // First wire of an entry (the only one for the SIMD arithmetic gates used here)
+  const std::shared_ptr<MOTION::NewWire>& wire(std::size_t row, std::size_t col = 0) const {
+    return wires_[index(row, col)];
+  }
+
+  // Entry as a WireVector, e.g. as gate factory input
+  MOTION::WireVector get(std::size_t row, std::size_t col = 0) const {
+    auto first = wires_.begin() + index(row, col);
+    return MOTION::WireVector(first, first + width_);
+  }
+
+  // All entries as WireVectors, e.g. as inputs of a tree reduction
+  std::vector<MOTION::WireVector> entries() const {
+    std::vector<MOTION::WireVector> result;
+    result.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i) {
+      result.push_back(get(i / cols_, i % cols_));
+    }
+    return result;
+  }
+
+  // Iteration over every wire of every entry
+  auto begin() const { return wires_.begin(); }
+  auto end() const { return wires_.end(); }
+
+ private:
+  std::size_t index(std::size_t row, std::size_t col) const { return (row * cols_ + col) * width_; }
+
+  std::size_t rows_ = 0;
+  std::size_t cols_ = 0;
+  std::size_t width_ = 0;
+  std::vector<std::shared_ptr<MOTION::NewWire>> wires_;
+};
+
+// Structure to hold individual character wires and promises for secret sharing
 struct SecretSharedData {
     // PATTERN DATA: Individual secret sharing for each pattern character
     // - Each pattern character gets its own wire and promise
     // - For pattern "HEL": 3 wires (one for 'H', 'E', 'L')
     
-    std::vector<MOTION::WireVector> pattern_char_wires;
-    // ↳ Wire containers that hold secret shares after circuit execution
-    // ↳ pattern_char_wires[0] = wire holding share of 1st character ('H')
-    // ↳ Each wire stores one uint8_t share value (e.g., 165)
-    // ↳ MOTION::WireVector = std::vector<std::shared_ptr<NewWire>> (size 1 for single values)
+    WireTable pattern_char_wires;
+    // ↳ Wires that hold secret shares after circuit execution, 1 x pattern_size table
+    // ↳ pattern_char_wires.wire(0, 0) = wire holding share of 1st character ('H')
+    // ↳ Each wire stores one uint8_t share value (e.g., 165)
+    
+    std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>>> pattern_char_promises;
+    // ↳ Input mechanisms where actual ASCII values are provided
+    // ↳ pattern_char_promises[0].set_value({72}) feeds 'H' into secret sharing
+    // ↳ Promise fulfillment triggers generation of secret shares
+    // ↳ MOTION::IntegerValues<uint8_t> = std::vector<uint8_t> (size 1 for single values)
+    
+    // TEXT DATA: Individual secret sharing for each character in each sliding window
+    // - For text "HELLO" with pattern_size=3: 3 windows, each with 3 characters
+    // - Window 1: ['H','E','L'], Window 2: ['E','L','L'], Window 3: ['L','L','O']
+    
+    WireTable text_window_wires;
+    // ↳ num_windows x pattern_size table: text_window_wires.wire(window, position)
+    // ↳ text_window_wires.wire(0, 0) = wire for 1st character of 1st window ('H')
+    // ↳ text_window_wires.wire(1, 2) = wire for 3rd character of 2nd window ('L')
+    
+    std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>>> text_window_promises;
+    // ↳ Flat, row-major like the wire table: text_window_promises[window * pattern_size + position]
+    // ↳ text_window_promises[0].set_value({72}) feeds 'H' from window 1
+    // ↳ Each promise provides one ASCII character to the secret sharing process
+
+    // SIMD INPUT MODE (--simd-inputs): the whole pattern and the whole text are each shared once
+    // - Only used instead of the per-character members above when options.simd_inputs is set
+    // - Sliding windows are index views over the text share vector: T_w[pos] = text lane (w + pos)
+
+    MOTION::WireVector pattern_wires;
+    // ↳ One wire with num_simd = pattern_size, lane i holds the share of pattern character i
+
+    ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>> pattern_promise;
+    // ↳ pattern_promise.set_value(pattern_ascii) feeds the entire pattern at once
+
+    MOTION::WireVector text_wires;
+    // ↳ One wire with num_simd = text_size, lane i holds the share of text character i
+
+    ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>> text_promise;
+    // ↳ text_promise.set_value(text_ascii) feeds the entire text at once
+};
+
+// Shares of the pattern characters held by this party, for either input mode
+// (all patterns of a batch, concatenated)
+std::vector<uint8_t> get_pattern_shares(const Options& options, const SecretSharedData& shared_data) {
+  if (options.simd_inputs) {
+    auto span = ShareKernels::get_share_span<uint8_t>(shared_data.pattern_wires);
+    return std::vector<uint8_t>(span.data, span.data + span.size);
+  }
+  std::vector<uint8_t> shares(options.num_patterns * options.pattern_size);
+  for (size_t i = 0; i < shares.size(); ++i) {
+    shares[i] = ShareKernels::get_share_span<uint8_t>(shared_data.pattern_char_wires.wire(0, i))[0];
+  }
+  return shares;
+}
+
+// Sliding windows over the text shares held by this party, for either input mode
+// - SIMD input mode: a stride-1 view straight into the text wire's share vector (no copy)
+// - Per-window mode: the per-position shares are gathered once into `storage` (stride pattern_size)
+StringProcessing::SlidingWindows get_text_share_windows(const Options& options, const SecretSharedData& shared_data,
+                                                        std::vector<uint8_t>& storage) {
+  size_t num_windows = options.text_size - options.pattern_size + 1;
+  if (options.simd_inputs) {
+    auto span = ShareKernels::get_share_span<uint8_t>(shared_data.text_wires);
+    return {span.data, num_windows, options.pattern_size, 1};
+  }
+  storage.resize(num_windows * options.pattern_size);
+  HostParallel::parallel_for(options.threads, num_windows, HostParallel::default_grain, [&](size_t begin, size_t end) {
+    for (size_t window = begin; window < end; ++window) {
+      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
+        storage[window * options.pattern_size + pos] =
+            ShareKernels::get_share_span<uint8_t>(shared_data.text_window_wires.wire(window, pos))[0];
+      }
+    }
+  });
+  return {storage.data(), num_windows, options.pattern_size, options.pattern_size};
+}
+
+// Every Phase 1 wire whose share this party reads locally
+std::vector<MOTION::NewWireP> shared_input_wires(const Options& options, const SecretSharedData& shared_data) {
+  if (options.simd_inputs) {
+    return {shared_data.pattern_wires[0], shared_data.text_wires[0]};
+  }
+  std::vector<MOTION::NewWireP> wires;
+  for (const auto& wire : shared_data.pattern_char_wires) {
+    wires.push_back(wire);
+  }
+  for (const auto& wire : shared_data.text_window_wires) {
+    wires.push_back(wire);
+  }
+  return wires;
+}
+
+// Create input wires with individual character secret sharing
+// This function sets up the MPC input gates for both parties based on their roles
+auto create_circuit_inputs(const Options& options, MOTION::TwoPartyBackend& backend) {
+  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
+  
+  SecretSharedData shared_data;
+  size_t num_windows = options.text_size - options.pattern_size + 1;  // Number of sliding windows
+  size_t pattern_chars = options.num_patterns * options.pattern_size;  // All patterns of a batch
+
+  if (options.simd_inputs) {
+    // SIMD INPUT MODE: one input gate for the pattern, one for the text (O(n) instead of O(n*m))
+    // Both parties create the pattern gate first and the text gate second
+    if (options.role == "pattern_holder") {
+      auto pattern_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, pattern_chars);
+      shared_data.pattern_promise = std::move(pattern_pair.first);
+      shared_data.pattern_wires = std::move(pattern_pair.second);
+
+      shared_data.text_wires =
+          gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, options.text_size);
+    } else if (options.role == "text_holder") {
+      shared_data.pattern_wires =
+          gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, pattern_chars);
+
+      auto text_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, options.text_size);
+      shared_data.text_promise = std::move(text_pair.first);
+      shared_data.text_wires = std::move(text_pair.second);
+    }
+    return shared_data;
+  }
+
+  if (options.role == "pattern_holder") {
+    // PATTERN HOLDER: Creates input gates for their own pattern, receives gates for other's text
+    
+    // Create individual input gates for each pattern character (OWN DATA)
+    // Each gate produces a [promise, wire] pair for one character
+    shared_data.pattern_char_wires = WireTable(1, pattern_chars);
+    shared_data.pattern_char_promises.resize(pattern_chars);
     
-    std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>>> pattern_char_promises;
-    // ↳ Input mechanisms where actual ASCII values are provided
-    // ↳ pattern_char_promises[0].set_value({72}) feeds 'H' into secret sharing
-    // ↳ Promise fulfillment triggers generation of secret shares
-    // ↳ MOTION::IntegerValues<uint8_t> = std::vector<uint8_t> (size 1 for single values)
+    for (size_t i = 0; i < pattern_chars; ++i) {
+      // make_arithmetic_8_input_gate_my() creates an input gate for data WE own
+      // Returns: std::pair<Promise, WireVector>
+      // - Promise (first): Input mechanism to provide our secret ASCII value
+      // - WireVector (second): Output wire that will contain our share of the value
+      auto pattern_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
+      shared_data.pattern_char_promises[i] = std::move(pattern_pair.first);   // Input side
+      shared_data.pattern_char_wires.set(0, i, pattern_pair.second);          // Output side
+    }
+    
+    // Create receiver gates for text character shares from the other party (OTHER'S DATA)
+    shared_data.text_window_wires = WireTable(num_windows, options.pattern_size);
+    for (size_t window = 0; window < num_windows; ++window) {
+      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
+        // make_arithmetic_8_input_gate_other() creates a receiver gate for data THEY own
+        // Returns: WireVector (no promise since we don't provide the input)
+        // This wire will receive the share of the other party's character
+        shared_data.text_window_wires.set(
+            window, pos, gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1));
+      }
+    }
+    
+  } else if (options.role == "text_holder") {
+    // TEXT HOLDER: Receives gates for other's pattern, creates input gates for their own text
+    
+    // Create receiver gates for pattern character shares from the other party (OTHER'S DATA)
+    shared_data.pattern_char_wires = WireTable(1, pattern_chars);
+    for (size_t i = 0; i < pattern_chars; ++i) {
+      // Receive shares of pattern holder's characters
+      shared_data.pattern_char_wires.set(
+          0, i, gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1));
+    }
+    
+    // Create individual input gates for each text character in each window (OWN DATA)
+    shared_data.text_window_wires = WireTable(num_windows, options.pattern_size);
+    shared_data.text_window_promises.resize(num_windows * options.pattern_size);
+    
+    for (size_t window = 0; window < num_windows; ++window) {
+      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
+        // Create input gate for our text character at this window position
+        auto text_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
+        shared_data.text_window_promises[window * options.pattern_size + pos] =
+            std::move(text_pair.first);                                     // Input side
+        shared_data.text_window_wires.set(window, pos, text_pair.second);  // Output side
+      }
+    }
+  }
+  
+  return shared_data;
+}
+
+// Function to extract and display share values with both kept and sent shares
+// This function demonstrates how to access the actual cryptographic shares after circuit execution
+void print_share_details(const Options& options, const SecretSharedData& shared_data, 
+                        const std::vector<uint8_t>* pattern_values = nullptr,
+                        const StringProcessing::SlidingWindows* text_windows = nullptr) {
+  
+  size_t num_windows = options.text_size - options.pattern_size + 1;
+  size_t pattern_chars = options.num_patterns * options.pattern_size;
+
+  // Pattern characters are labelled P[pos], or P<k>[pos] for pattern k of a batch
+  auto pattern_label = [&](size_t i) {
+    std::string label = "P";
+    if (options.num_patterns > 1) {
+      label += std::to_string(i / options.pattern_size + 1);
+    }
+    return label + "[" + std::to_string(i % options.pattern_size) + "]";
+  };
+
+  // WIRE ACCESS: Read the ArithmeticGMWWire<uint8_t> shares once and view them
+  // as pattern characters / sliding windows, for either input mode
+  std::vector<uint8_t> pattern_shares = get_pattern_shares(options, shared_data);
+  std::vector<uint8_t> text_share_storage;
+  StringProcessing::SlidingWindows text_share_windows =
+      get_text_share_windows(options, shared_data, text_share_storage);
+
+  std::cout << "\n\n\n" << std::endl;
+  if (options.role == "pattern_holder") {
+    std::cout << "=== MY PATTERN SHARES (Owned) ===" << std::endl;
+    // SHARE EXTRACTION: Access the actual secret shares from owned pattern wires
+    for (size_t i = 0; i < pattern_chars; ++i) {
+      char original_char = static_cast<char>((*pattern_values)[i]);
+      uint8_t original_value = (*pattern_values)[i];
+      uint8_t my_share = pattern_shares[i];  // The cryptographic share we keep
+      
+      // SENT SHARE CALCULATION: In GMW, sent_share + my_share = original_value (mod 2^8)
+      // This shows what we sent to the other party to complete the secret sharing
+      uint8_t sent_share = original_value - my_share;  // What we sent to the other party
+      
+      std::cout << pattern_label(i) << " = '" << original_char << "' (" << (int)original_value 
+                << "): My share = " << (int)my_share << ", Sent share = " << (int)sent_share << std::endl;
+    }
+    
+    std::cout << "\n=== RECEIVED TEXT SHARES ===" << std::endl;
+    // RECEIVED SHARES: Display shares we received from the text holder
+    for (size_t window = 0; window < num_windows; ++window) {
+      std::cout << "Window T" << (window + 1) << ":" << std::endl;
+      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
+        // WIRE ACCESS: Get the share the text holder sent us for this window position
+        // We cannot reconstruct the original value since we only have one share
+        std::cout << "  T" << (window + 1) << "[" << pos << "]: Received share = " 
+                  << (int)text_share_windows[window][pos] << std::endl;
+      }
+    }
+    
+  } else if (options.role == "text_holder") {
+    std::cout << "=== RECEIVED PATTERN SHARES ===" << std::endl;
+    // RECEIVED SHARES: Display shares we received from the pattern holder
+    for (size_t i = 0; i < pattern_chars; ++i) {
+      // RECEIVED SHARE: This is the share the pattern holder sent us
+      // We cannot reconstruct the original character since we only have one share
+      std::cout << pattern_label(i) << ": Received share = "
+                << (int)pattern_shares[i] << std::endl;
+    }
+    
+    std::cout << "\n=== MY TEXT SHARES (Owned) ===" << std::endl;
+    // SHARE EXTRACTION: Access the actual secret shares from owned text wires  
+    for (size_t window = 0; window < num_windows; ++window) {
+      std::cout << "Window T" << (window + 1) << ":" << std::endl;
+      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
+        // WIRE ACCESS: Read the share data for this window position
+        char original_char = static_cast<char>((*text_windows)[window][pos]);
+        uint8_t original_value = (*text_windows)[window][pos];
+        uint8_t my_share = text_share_windows[window][pos];  // The cryptographic share we keep
+        
+        // SENT SHARE CALCULATION: Show what we sent to complete the secret sharing
+        uint8_t sent_share = original_value - my_share;  // What we sent to the other party
+        
+        std::cout << "  T" << (window + 1) << "[" << pos << "] = '" << original_char 
+                  << "' (" << (int)original_value << "): My share = " << (int)my_share 
+                  << ", Sent share = " << (int)sent_share << std::endl;
+      }
+    }
+  }
+}
+
+
+
+
+
+
+
+// Host-side buffers of one chunk (inputs, gathered shares, differences, hashes)
+// Kept in a WorkspacePool across chunks, repetitions and service queries: for a query of the same
+// shape every resize() stays within the capacity, so the buffers are allocated only once
+struct ChunkWorkspace {
+  std::vector<uint8_t> pattern_values;
+  std::vector<uint8_t> text_values;
+  std::vector<uint8_t> text_shares;  // text shares gathered per window without --simd-inputs
+  std::vector<uint8_t> differences;
+  std::vector<uint8_t> hash_input_blocks;
+  StringProcessing::WindowHashes hashes;
+};
+
+// Free list of chunk workspaces, owned by main for the whole process
+// Chunks acquire a workspace when they are built and hand it back after their backend run, so a
+// pipeline with chunks_in_flight chunks keeps that many workspaces warm (used from one thread)
+// Only these host buffers are reused: the backend itself, with its gates, wires, thread pool and
+// base OT / triple setup, is still built from scratch for every run (see run_exact_pm_pipeline)
+class WorkspacePool {
+ public:
+  std::unique_ptr<ChunkWorkspace> acquire() {
+    if (free_.empty()) {
+      ++created_;
+      return std::make_unique<ChunkWorkspace>();
+    }
+    auto workspace = std::move(free_.back());
+    free_.pop_back();
+    return workspace;
+  }
+
+  void release(std::unique_ptr<ChunkWorkspace> workspace) {
+    if (workspace) {
+      free_.push_back(std::move(workspace));
+    }
+  }
+
+  // Workspaces allocated so far; stays at chunks_in_flight for repeated queries of one shape
+  std::size_t created() const { return created_; }
+
+ private:
+  std::vector<std::unique_ptr<ChunkWorkspace>> free_;
+  std::size_t created_ = 0;
+};
+
+// Local difference + hash of one chunk, into workspace.hashes
+void compute_difference_concat_hash(const Options& options, const SecretSharedData& shared_data,
+                                    ChunkWorkspace& workspace) {
+
+  size_t num_windows = options.text_size - options.pattern_size + 1;
+  size_t pattern_size = options.pattern_size;
+  bool negate = (options.role == "pattern_holder");
+
+  std::vector<uint8_t> pattern_shares = get_pattern_shares(options, shared_data);
+  StringProcessing::SlidingWindows text_share_windows =
+      get_text_share_windows(options, shared_data, workspace.text_shares);
+
+  // Share differences of all windows in one pass per pattern into a flat
+  // (num_patterns * num_windows) x pattern_size buffer; row k * num_windows + w is window w against
+  // pattern k, and that row order is the SIMD lane order of Phase 2 and 3
+  // The pattern holder negates so that both parties hold equal values exactly when T_w == P
+  size_t num_patterns = options.num_patterns;
+  // Window ranges are claimed by --threads threads, each one covering its range for every pattern
+  // Common pattern lengths run kernels specialized for that length (see dispatch_pattern_size)
+  auto& differences = workspace.differences;
+  differences.resize(num_patterns * num_windows * pattern_size);
+  StringProcessing::SlidingWindows difference_windows{differences.data(), num_patterns * num_windows,
+                                                      pattern_size, pattern_size};
+  StringProcessing::WindowHashes& window_hashes = workspace.hashes;
+  ShareKernels::dispatch_pattern_size(pattern_size, [&](auto length) {
+    constexpr size_t M = decltype(length)::value;
+    HostParallel::parallel_for(options.threads, num_windows, HostParallel::default_grain,
+                               [&](size_t begin, size_t end) {
+      StringProcessing::SlidingWindows range{text_share_windows.base + begin * text_share_windows.stride,
+                                             end - begin, pattern_size, text_share_windows.stride};
+      for (size_t k = 0; k < num_patterns; ++k) {
+        ShareKernels::compute_window_differences_fixed<M>(range, pattern_shares.data() + k * pattern_size, negate,
+                                                          differences.data() + (k * num_windows + begin) * pattern_size);
+      }
+    });
+
+    // Hash all difference vectors in batches over the same threads
+    StringProcessing::hash_difference_windows<M>(difference_windows, window_hashes, workspace.hash_input_blocks,
+                                                 options.fingerprint_bits / 8, options.threads);
+  });
+
+  if (options.verbose) {
+    std::cout << "\n\n=== Computing differences ===" << std::endl;
+    for (size_t lane = 0; lane < difference_windows.size(); ++lane) {
+      size_t k = lane / num_windows;
+      size_t window = lane % num_windows;
+      std::string pattern_name = num_patterns > 1 ? "P" + std::to_string(k + 1) : "P";
+      std::cout << "Window T" << (window + 1) << (num_patterns > 1 ? " vs " + pattern_name : "") << ":"
+                << std::endl;
+      std::string concatenated_shares;
+      for (size_t pos = 0; pos < pattern_size; ++pos) {
+        std::cout << "  T" << (window + 1) << "[" << pos << "] - " << pattern_name << "[" << pos << "]: "
+                  << (int)text_share_windows[window][pos] << " - " << (int)pattern_shares[k * pattern_size + pos]
+                  << (negate ? ", negated: " : ": ") << (int)difference_windows[lane][pos] << "\n";
+        concatenated_shares += std::to_string(difference_windows[lane][pos]);
+      }
+
+      std::cout << "\n  Concatenated: " << concatenated_shares << std::endl;
+      std::cout << "  Hash (" << options.fingerprint_bits << "-bit): "
+                << StringProcessing::concat_vector(window_hashes[lane]) << std::endl;
+      std::cout << "  Full hash size: " << window_hashes[lane].size() << " bytes\n\n\n";
+    }
+  }
+}
+
+
+
+
+
+// Print the Phase 1 summary and share details after the circuit was executed
+void print_pattern_text_circuit_summary(const Options& options, const SecretSharedData& shared_data,
+                                        const std::vector<uint8_t>* pattern_values = nullptr,
+                                        const StringProcessing::SlidingWindows* text_windows = nullptr) {
+  std::cout << "\n=== Circuit Execution Summary ===" << std::endl;
+  std::cout << "Individual character secret sharing circuit executed successfully!" << std::endl;
+  
+  size_t num_windows = options.text_size - options.pattern_size + 1;
+  size_t total_pattern_chars = options.num_patterns * options.pattern_size;
+  size_t total_text_chars = num_windows * options.pattern_size;
+  
+  if (options.simd_inputs) {
+    std::cout << "Pattern: " << total_pattern_chars << " characters shared in 1 SIMD input" << std::endl;
+    std::cout << "Text: " << options.text_size << " characters shared in 1 SIMD input, viewed as "
+              << num_windows << " windows" << std::endl;
+    std::cout << "Total input gates: 2" << std::endl;
+  } else {
+    std::cout << "Pattern: " << total_pattern_chars << " individual character secrets shared" << std::endl;
+    std::cout << "Text: " << total_text_chars << " individual character secrets shared across " 
+              << num_windows << " windows" << std::endl;
+    std::cout << "Total individual secret sharings: " << (total_pattern_chars + total_text_chars) << std::endl;
+  }
+  
+  // Display actual share values after circuit execution
+  print_share_details(options, shared_data, pattern_values, text_windows);
+}
+
+
+
+
+// Word size of the compared values (the T of the pipeline): hash words, or the ring of --mode rolling
+std::size_t compare_word_bits(const Options& options) {
+  return options.match_mode == MatchMode::rolling ? options.ring_bits : options.hash_word_bits;
+}
+
+// Zero tests (HAM + DPF) per window: one per hash word, or the single fingerprint of --mode rolling
+std::size_t compare_words(const Options& options) {
+  if (options.match_mode == MatchMode::rolling) {
+    return 1;
+  }
+  return options.fingerprint_bits / options.hash_word_bits;
+}
+
+// Domain of the DPF zero test behind every HAM gate: the Hamming weight of a word of at most 64
+// bits is below 2^8, so it is tested in Z_{2^8} whatever the word size (see narrow_ham_outputs)
+constexpr std::size_t dpf_domain_bits = 8;
+
+// Upper bound on the probability that any non-matching (pattern, window) pair of one repetition is
+// reported as a match
+// --mode hash models the fixed-key AES permutation as random: two different share differences collide
+// in one of the chaining steps over the window's 16-byte blocks (2^-128 each) or in the F-bit output
+// (2^-F)
+double false_positive_bound(const Options& options) {
+  double lanes = static_cast<double>(options.num_patterns) * (options.text_size - options.pattern_size + 1);
+  if (options.match_mode == MatchMode::rolling) {
+    return std::min(1.0, lanes * std::ldexp(1.0, 7 - static_cast<int>(options.ring_bits)));
+  }
+  std::size_t hash_input_bits = 8 * StringProcessing::hash_input_size;
+  double window_bound =
+      StringProcessing::chain_steps(options.pattern_size) * std::ldexp(1.0, -static_cast<int>(hash_input_bits)) +
+      std::ldexp(1.0, -static_cast<int>(options.fingerprint_bits));
+  return std::min(1.0, lanes * window_bound);
+}
+
+// Number of SIMD OR levels of the per-pattern OR tree of --result-mode any over `width` window lanes
+// (each level halves the lanes)
+std::size_t lane_or_levels(std::size_t width) {
+  std::size_t levels = 0;
+  for (; width > 1; width = (width + 1) / 2) {
+    ++levels;
+  }
+  return levels;
+}
+
+// Modeled online traffic of one repetition, per phase and gate kind, from this party's view
+// The communication layer only counts totals, so the ledger is derived from the circuit shape:
+// - arithmetic input: the owner sends one masked value per SIMD lane
+// - HAM / DPF: both parties open their share of the masked gate input, one word (HAM) or one
+//   dpf_domain_bits value (DPF) per lane
+// - Boolean AND: both parties open d and e (two bits per lane) of the Beaver triple
+// Whatever the measured totals hold beyond this (setup: OTs for triples, DPF key generation,
+// synchronisation) is reported as the residual
+// online_rounds counts the communication rounds of the online phase along the critical path:
+// Phase 1 inputs, Phase 2 inputs, HAM opening, DPF opening and one per AND tree level
+struct CommunicationLedger {
+  struct Entry {
+    std::string phase;
+    std::string gate;
+    std::size_t msgs_sent = 0;
+    std::size_t bytes_sent = 0;
+    std::size_t msgs_received = 0;
+    std::size_t bytes_received = 0;
+  };
+  std::vector<Entry> entries;
+  std::size_t online_rounds = 0;
+
+  std::size_t bytes_sent() const { return sum(&Entry::bytes_sent); }
+  std::size_t bytes_received() const { return sum(&Entry::bytes_received); }
+  std::size_t msgs_sent() const { return sum(&Entry::msgs_sent); }
+  std::size_t msgs_received() const { return sum(&Entry::msgs_received); }
+
+ private:
+  std::size_t sum(std::size_t Entry::*field) const {
+    std::size_t total = 0;
+    for (const auto& entry : entries) {
+      total += entry.*field;
+    }
+    return total;
+  }
+};
+
+// Smallest arithmetic word size (8, 16, 32 or 64 bits) holding counts up to max_count
+std::size_t count_word_bits(std::size_t max_count) {
+  if (max_count <= std::numeric_limits<uint8_t>::max()) {
+    return 8;
+  } else if (max_count <= std::numeric_limits<uint16_t>::max()) {
+    return 16;
+  } else if (max_count <= std::numeric_limits<uint32_t>::max()) {
+    return 32;
+  }
+  return 64;
+}
+
+// Windows per chunk of a query (all windows without --chunk-windows)
+std::size_t chunk_window_count(const Options& options) {
+  std::size_t total_windows = options.text_size - options.pattern_size + 1;
+  return options.chunk_windows == 0 ? total_windows : std::min(options.chunk_windows, total_windows);
+}
+
+// Ledger of one chunk of num_windows windows (text slice of num_windows + pattern_size - 1 characters)
+CommunicationLedger compute_chunk_ledger(const Options& options, std::size_t num_windows) {
+  CommunicationLedger ledger;
+  std::size_t chunk_text_size = num_windows + options.pattern_size - 1;
+  std::size_t word_bytes = compare_word_bits(options) / 8;
+  std::size_t hash_words = compare_words(options);
+  bool pattern_holder = options.role == "pattern_holder";
+  bool rolling = options.match_mode == MatchMode::rolling;
+
+  // Phase 1: pattern and text characters (one byte per lane, one ring element in --mode rolling);
+  // per-window gates without --simd-inputs (--mode rolling always shares SIMD inputs)
+  bool simd_inputs = options.simd_inputs || rolling;
+  std::size_t char_bytes = rolling ? word_bytes : 1;
+  std::size_t pattern_chars = options.num_patterns * options.pattern_size;
+  std::size_t pattern_gates = simd_inputs ? 1 : pattern_chars;
+  std::size_t pattern_bytes = pattern_chars * char_bytes;
+  std::size_t text_gates = simd_inputs ? 1 : num_windows * options.pattern_size;
+  std::size_t text_bytes = (simd_inputs ? chunk_text_size : num_windows * options.pattern_size) * char_bytes;
+  if (pattern_holder) {
+    ledger.entries.push_back({"phase1", "arithmetic_input", pattern_gates, pattern_bytes, 0, 0});
+    ledger.entries.push_back({"phase1", "arithmetic_input", 0, 0, text_gates, text_bytes});
+  } else {
+    ledger.entries.push_back({"phase1", "arithmetic_input", 0, 0, pattern_gates, pattern_bytes});
+    ledger.entries.push_back({"phase1", "arithmetic_input", text_gates, text_bytes, 0, 0});
+  }
+
+  // Phase 2 and 3: one gate per word plane, SIMD over the windows of all patterns, symmetric for both parties
+  // (--mode rolling has no Phase 2: the fingerprint shares are computed locally)
+  std::size_t num_lanes = options.num_patterns * num_windows;
+  std::size_t plane_bytes = num_lanes * word_bytes;
+  if (!rolling) {
+    ledger.entries.push_back({"phase2", "arithmetic_input", hash_words, hash_words * plane_bytes, hash_words,
+                              hash_words * plane_bytes});
+  }
+  ledger.entries.push_back(
+      {"phase3", "ham_open", hash_words, hash_words * plane_bytes, hash_words, hash_words * plane_bytes});
+  std::size_t dpf_plane_bytes = num_lanes * dpf_domain_bits / 8;
+  ledger.entries.push_back({"phase3", "dpf_open", hash_words, hash_words * dpf_plane_bytes, hash_words,
+                            hash_words * dpf_plane_bytes});
+  std::size_t and_gates = hash_words - 1;
+  std::size_t and_bytes = 2 * ((num_lanes + 7) / 8);
+  if (!rolling) {
+    ledger.entries.push_back(
+        {"phase3", "boolean_and", and_gates, and_gates * and_bytes, and_gates, and_gates * and_bytes});
+  }
+
+  // Phase 1, (Phase 2,) HAM and DPF openings, AND tree levels
+  ledger.online_rounds = (rolling ? 3 : 4) + static_cast<std::size_t>(std::ceil(std::log2(hash_words)));
+
+  // Result: the chunk's part of the aggregate of --result-mode; positions are opened per chunk,
+  // any / count once per query (see compute_communication_ledger)
+  // (the B2A conversion of --result-mode count runs OTs whose traffic lands in the residual)
+  switch (options.result_mode) {
+    case ResultMode::shares:
+      break;
+    case ResultMode::any: {
+      std::size_t or_gates = lane_or_levels(num_windows);
+      std::size_t or_bytes = 0;
+      for (std::size_t width = num_windows; width > 1; width = (width + 1) / 2) {
+        or_bytes += 2 * ((options.num_patterns * ((width + 1) / 2) + 7) / 8);
+      }
+      ledger.entries.push_back({"result", "boolean_or", or_gates, or_bytes, or_gates, or_bytes});
+      ledger.online_rounds += or_gates;
+      break;
+    }
+    case ResultMode::count:
+      ledger.online_rounds += 1;
+      break;
+    case ResultMode::positions: {
+      ledger.online_rounds += 1;
+      std::size_t result_bytes = (num_lanes + 7) / 8;
+      ledger.entries.push_back({"result", "output", 1, result_bytes, 1, result_bytes});
+      break;
+    }
+  }
+  return ledger;
+}
+
+// Ledger of the whole query: the sum over its chunks; chunks in one backend run overlap, so the
+// runs (not the chunks) add up along the critical path
+CommunicationLedger compute_communication_ledger(const Options& options) {
+  std::size_t total_windows = options.text_size - options.pattern_size + 1;
+  std::size_t chunk_windows = chunk_window_count(options);
+  std::size_t full_chunks = total_windows / chunk_windows;
+  std::size_t last_chunk_windows = total_windows % chunk_windows;
+
+  CommunicationLedger ledger = compute_chunk_ledger(options, chunk_windows);
+  for (auto& entry : ledger.entries) {
+    entry.msgs_sent *= full_chunks;
+    entry.bytes_sent *= full_chunks;
+    entry.msgs_received *= full_chunks;
+    entry.bytes_received *= full_chunks;
+  }
+  if (last_chunk_windows != 0) {
+    auto last_chunk = compute_chunk_ledger(options, last_chunk_windows);
+    for (std::size_t i = 0; i < ledger.entries.size(); ++i) {
+      ledger.entries[i].msgs_sent += last_chunk.entries[i].msgs_sent;
+      ledger.entries[i].bytes_sent += last_chunk.entries[i].bytes_sent;
+      ledger.entries[i].msgs_received += last_chunk.entries[i].msgs_received;
+      ledger.entries[i].bytes_received += last_chunk.entries[i].bytes_received;
+    }
+  }
+  std::size_t num_chunks = full_chunks + (last_chunk_windows != 0);
+  std::size_t num_runs = (num_chunks + options.chunks_in_flight - 1) / options.chunks_in_flight;
+  ledger.online_rounds *= num_runs;
+
+  // any / count: the chunk aggregates of every run (and the carry of the runs before it) are
+  // combined, an OR tree of num_patterns lanes for any and a local sum for count, and the
+  // query's aggregate is opened once
+  std::size_t result_bytes = 0;
+  if (options.result_mode == ResultMode::any) {
+    std::size_t or_gates = 0;
+    std::size_t or_rounds = 0;
+    for (std::size_t run = 0, chunks = num_chunks; run < num_runs; ++run) {
+      std::size_t run_chunks = std::min(chunks, options.chunks_in_flight);
+      chunks -= run_chunks;
+      std::size_t inputs = run_chunks + (run > 0);
+      or_gates += inputs - 1;
+      or_rounds += lane_or_levels(inputs);
+    }
+    std::size_t or_bytes = or_gates * 2 * ((options.num_patterns + 7) / 8);
+    ledger.entries.push_back({"result", "boolean_or_chunks", or_gates, or_bytes, or_gates, or_bytes});
+    ledger.online_rounds += or_rounds;
+    result_bytes = (options.num_patterns + 7) / 8;
+  } else if (options.result_mode == ResultMode::count) {
+    result_bytes = options.num_patterns * count_word_bits(total_windows) / 8;
+  }
+  if (revealed_per_query(options.result_mode)) {
+    ledger.entries.push_back({"result", "output", 1, result_bytes, 1, result_bytes});
+    ledger.online_rounds += 1;
+  }
+  return ledger;
+}
+
+// The "modeled_communication" stats object: the ledger per repetition and its totals scaled to all
+// repetitions (derived from the circuit shape, not measured), next to the totals the communication
+// layer measured and the residual between the two
+boost::json::object to_json(const CommunicationLedger& ledger, std::size_t repetitions,
+                            const MOTION::Statistics::AccumulatedCommunicationStats& comm_stats) {
+  boost::json::array entries;
+  for (const auto& entry : ledger.entries) {
+    boost::json::object entry_obj;
+    entry_obj.emplace("phase", entry.phase);
+    entry_obj.emplace("gate", entry.gate);
+    entry_obj.emplace("msgs_sent", entry.msgs_sent);
+    entry_obj.emplace("bytes_sent", entry.bytes_sent);
+    entry_obj.emplace("msgs_received", entry.msgs_received);
+    entry_obj.emplace("bytes_received", entry.bytes_received);
+    entries.push_back(std::move(entry_obj));
+  }
+  auto residual = [](std::size_t measured, std::size_t modeled) {
+    return static_cast<std::int64_t>(measured) - static_cast<std::int64_t>(modeled);
+  };
+
+  boost::json::object obj;
+  obj.emplace("per_repetition", std::move(entries));
+  obj.emplace("online_rounds", ledger.online_rounds);
+  obj.emplace("modeled_bytes_sent", repetitions * ledger.bytes_sent());
+  obj.emplace("modeled_bytes_received", repetitions * ledger.bytes_received());
+  obj.emplace("modeled_msgs_sent", repetitions * ledger.msgs_sent());
+  obj.emplace("modeled_msgs_received", repetitions * ledger.msgs_received());
+  obj.emplace("measured_bytes_sent", comm_stats.num_bytes_sent_);
+  obj.emplace("measured_bytes_received", comm_stats.num_bytes_received_);
+  obj.emplace("measured_msgs_sent", comm_stats.num_msgs_sent_);
+  obj.emplace("measured_msgs_received", comm_stats.num_msgs_received_);
+  obj.emplace("residual_bytes_sent", residual(comm_stats.num_bytes_sent_, repetitions * ledger.bytes_sent()));
+  obj.emplace("residual_bytes_received",
+              residual(comm_stats.num_bytes_received_, repetitions * ledger.bytes_received()));
+  obj.emplace("residual_msgs_sent", residual(comm_stats.num_msgs_sent_, repetitions * ledger.msgs_sent()));
+  obj.emplace("residual_msgs_received",
+              residual(comm_stats.num_msgs_received_, repetitions * ledger.msgs_received()));
+  return obj;
+}
+
+// Host-side stage timings, accumulated over repetitions (count, total, min, max per stage)
+// Stages are kept in the order they are first recorded; add() may be called from LocalGateRunner
+// callbacks while the backend runs
+class StageTimings {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  void add(const std::string& stage, std::chrono::nanoseconds duration) {
+    double ms = std::chrono::duration<double, std::milli>(duration).count();
+    std::scoped_lock lock(mutex_);
+    auto it = std::find_if(entries_.begin(), entries_.end(), [&](const auto& entry) { return entry.first == stage; });
+    if (it == entries_.end()) {
+      entries_.emplace_back(stage, Entry{1, ms, ms, ms});
+      return;
+    }
+    auto& entry = it->second;
+    ++entry.count;
+    entry.total_ms += ms;
+    entry.min_ms = std::min(entry.min_ms, ms);
+    entry.max_ms = std::max(entry.max_ms, ms);
+  }
+
+  boost::json::object to_json() const {
+    std::scoped_lock lock(mutex_);
+    boost::json::object obj;
+    for (const auto& [stage, entry] : entries_) {
+      boost::json::object stage_obj;
+      stage_obj.emplace("count", entry.count);
+      stage_obj.emplace("mean_ms", entry.total_ms / entry.count);
+      stage_obj.emplace("min_ms", entry.min_ms);
+      stage_obj.emplace("max_ms", entry.max_ms);
+      stage_obj.emplace("total_ms", entry.total_ms);
+      obj.emplace(stage, std::move(stage_obj));
+    }
+    return obj;
+  }
+
+  void print(std::ostream& os) const {
+    std::scoped_lock lock(mutex_);
+    os << "Stage timings (mean / min / max over repetitions, ms):\n";
+    for (const auto& [stage, entry] : entries_) {
+      os << "  " << std::left << std::setw(30) << stage << std::right << std::fixed << std::setprecision(3)
+         << entry.total_ms / entry.count << " / " << entry.min_ms << " / " << entry.max_ms << "\n";
+    }
+    os << std::defaultfloat;
+  }
+
+ private:
+  struct Entry {
+    std::size_t count;
+    double total_ms;
+    double min_ms;
+    double max_ms;
+  };
+  std::vector<std::pair<std::string, Entry>> entries_;
+  mutable std::mutex mutex_;
+};
+
+// User + system CPU time of this process so far
+std::chrono::nanoseconds process_cpu_time() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto to_ns = [](const timeval& tv) {
+    return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+  };
+  return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+// Peak resident set size of this process so far, in KiB (Linux reports ru_maxrss in KiB)
+std::size_t peak_rss_kib() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<std::size_t>(usage.ru_maxrss);
+}
+
+void print_stats(const Options& options,
+                 const MOTION::Statistics::AccumulatedRunTimeStats& run_time_stats,
+                 const MOTION::Statistics::AccumulatedCommunicationStats& comm_stats,
+                 const StageTimings& stage_timings,
+                 const SessionStatistics& session_stats = {}) {
+  if (options.json) {
+    auto obj = MOTION::Statistics::to_json("exact_pm", run_time_stats, comm_stats);
+    obj.emplace("party_id", options.my_id);
+    obj.emplace("threads", options.threads);
+    obj.emplace("sync_between_setup_and_online", options.sync_between_setup_and_online);
+    if (options.service) {
+      obj.emplace("query_id", options.query_id);
+      obj.emplace("text_size", options.text_size);
+      obj.emplace("pattern_size", options.pattern_size);
+    }
+    if (options.num_patterns > 1) {
+      obj.emplace("num_patterns", options.num_patterns);
+    }
+    if (options.match_mode == MatchMode::rolling) {
+      obj.emplace("mode", "rolling");
+      obj.emplace("ring_bits", options.ring_bits);
+    } else {
+      obj.emplace("fingerprint_bits", options.fingerprint_bits);
+    }
+    if (options.chunk_windows != 0) {
+      obj.emplace("chunk_windows", options.chunk_windows);
+      obj.emplace("chunks_in_flight", options.chunks_in_flight);
+    }
+    obj.emplace("repetitions", options.num_repetitions);
+    obj.emplace("false_positive_bound", false_positive_bound(options));
+    obj.emplace("stages", stage_timings.to_json());
+    obj.emplace("peak_rss_kib", peak_rss_kib());
+    obj.emplace("modeled_communication",
+                to_json(compute_communication_ledger(options), options.num_repetitions, comm_stats));
+    if (session_stats.coalescing.has_value()) {
+      auto coalescing = session_stats.coalescing->to_json();
+      coalescing.emplace("max_frame_bytes", options.coalesce_bytes);
+      coalescing.emplace("max_delay_us", options.coalesce_delay_us);
+      obj.emplace("coalescing", std::move(coalescing));
+    }
+    if (!session_stats.streams.empty()) {
+      boost::json::array streams;
+      for (const auto& stream : session_stats.streams) {
+        streams.push_back(stream.to_json());
+      }
+      obj.emplace("tcp_streams", std::move(streams));
+    }
+    std::cout << obj << "\n";
+  } else {
+    std::cout << MOTION::Statistics::print_stats("Exact Pattern Matching", run_time_stats,
+                                                 comm_stats);
+    stage_timings.print(std::cout);
+    std::cout << "Peak RSS: " << peak_rss_kib() << " KiB" << std::endl;
+    if (session_stats.coalescing.has_value()) {
+      const auto& c = *session_stats.coalescing;
+      std::cout << "Coalescing: " << c.messages_sent << " messages in " << c.frames_sent << " frames sent, "
+                << c.messages_received << " messages in " << c.frames_received << " frames received" << std::endl;
+    }
+    for (std::size_t i = 0; i < session_stats.streams.size(); ++i) {
+      const auto& s = session_stats.streams[i];
+      std::cout << "TCP stream " << i << ": " << s.bytes_sent << " bytes sent, " << s.bytes_received
+                << " bytes received" << std::endl;
+    }
+  }
+}
+
+
+
+// Host-side local gates: callbacks that run concurrently with backend.run() inside the same circuit
+// A callback blocks on the wires it reads (wait_online) and fulfils input promises of gates further
+// down the circuit, e.g. the local difference + hash step feeding the Phase 2 inputs. This lets all
+// phases share one backend run (and one TCP session) without a round trip through host code
+// A callback that throws would leave the gates after it waiting forever, so every callback that
+// fulfils promises or sets wires online registers an `abort` with it: it runs on the callback's
+// thread after the error and releases everything the callback had not fulfilled yet (zero inputs,
+// wires marked online), the run completes on those poisoned values and run() rethrows the error
+// If backend.run() throws, the wires the callbacks wait for may never come online. Callbacks
+// therefore wait through the runner: a failed run marks every wire a callback is blocked on
+// online and makes the waits throw, so each callback ends through its abort, the futures are
+// joined and run() throws a std::runtime_error for the caller to handle
+class LocalGateRunner {
+ public:
+  void add(std::function<void()> callback, std::function<void()> abort = {}) {
+    callbacks_.push_back({std::move(callback), std::move(abort)});
+  }
+
+  // Block until `wire` is online; throws once the backend run has failed
+  void wait_online(const MOTION::NewWireP& wire) {
+    {
+      std::scoped_lock lock(wait_mutex_);
+      throw_if_failed();
+      waiting_.push_back(wire);
+    }
+    wire->wait_online();
+    std::scoped_lock lock(wait_mutex_);
+    waiting_.erase(std::find(waiting_.begin(), waiting_.end(), wire));
+    throw_if_failed();
+  }
+
+  // Block until every wire of `wires` is online
+  template <typename Wires>
+  void wait_online(const Wires& wires) {
+    for (const auto& wire : wires) {
+      wait_online(wire);
+    }
+  }
+
+  // Run the backend with all registered callbacks in flight, then rethrow the first callback error
+  void run(MOTION::TwoPartyBackend& backend) {
+    failed_ = false;
+    std::mutex error_mutex;
+    std::exception_ptr first_error;
+    std::vector<std::future<void>> pending;
+    pending.reserve(callbacks_.size());
+    for (auto& entry : callbacks_) {
+      pending.push_back(std::async(std::launch::async, [entry = std::move(entry), &error_mutex, &first_error] {
+        try {
+          entry.callback();
+        } catch (...) {
+          {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!first_error) {
+              first_error = std::current_exception();
+            }
+          }
+          if (entry.abort) {
+            try {
+              entry.abort();
+            } catch (...) {
+            }
+          }
+        }
+      }));
+    }
+    callbacks_.clear();
+
+    std::string backend_error;
+    try {
+      backend.run();
+    } catch (const std::exception& e) {
+      backend_error = e.what();
+    } catch (...) {
+      backend_error = "unknown error";
+    }
+    if (!backend_error.empty()) {
+      release_waits();
+    }
+    for (auto& result : pending) {
+      result.get();
+    }
+    if (!backend_error.empty()) {
+      throw std::runtime_error("backend run failed: " + backend_error);
+    }
+    if (first_error) {
+      std::rethrow_exception(first_error);
+    }
+  }
+
+ private:
+  struct Entry {
+    std::function<void()> callback;
+    std::function<void()> abort;
+  };
+
+  void throw_if_failed() const {
+    if (failed_) {
+      throw std::runtime_error("backend run failed");
+    }
+  }
+
+  // Wake every callback blocked in wait_online(); later waits throw right away
+  void release_waits() {
+    std::vector<MOTION::NewWireP> blocked;
+    {
+      std::scoped_lock lock(wait_mutex_);
+      failed_ = true;
+      blocked = waiting_;
+    }
+    for (const auto& wire : blocked) {
+      wire->set_online_ready();
+    }
+  }
+
+  std::vector<Entry> callbacks_;
+  std::mutex wait_mutex_;  // waiting_, failed_
+  std::vector<MOTION::NewWireP> waiting_;
+  bool failed_ = false;
+};
+
+// Typed dispatch to make_arithmetic_{8,16,32,64}_input_gate_my of the gate factory
+template <typename T>
+auto make_arithmetic_input_gate_my(MOTION::GateFactory& gate_factory, std::size_t input_owner, std::size_t num_simd) {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return gate_factory.make_arithmetic_8_input_gate_my(input_owner, num_simd);
+  } else if constexpr (std::is_same_v<T, uint16_t>) {
+    return gate_factory.make_arithmetic_16_input_gate_my(input_owner, num_simd);
+  } else if constexpr (std::is_same_v<T, uint32_t>) {
+    return gate_factory.make_arithmetic_32_input_gate_my(input_owner, num_simd);
+  } else {
+    static_assert(std::is_same_v<T, uint64_t>, "unsupported arithmetic word type");
+    return gate_factory.make_arithmetic_64_input_gate_my(input_owner, num_simd);
+  }
+}
+
+// Typed dispatch to make_arithmetic_{8,16,32,64}_output_gate_my of the gate factory
+template <typename T>
+ENCRYPTO::ReusableFiberFuture<MOTION::IntegerValues<T>> make_arithmetic_output_gate_my(
+    MOTION::GateFactory& gate_factory, std::size_t output_owner, const MOTION::WireVector& wires) {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return gate_factory.make_arithmetic_8_output_gate_my(output_owner, wires);
+  } else if constexpr (std::is_same_v<T, uint16_t>) {
+    return gate_factory.make_arithmetic_16_output_gate_my(output_owner, wires);
+  } else if constexpr (std::is_same_v<T, uint32_t>) {
+    return gate_factory.make_arithmetic_32_output_gate_my(output_owner, wires);
+  } else {
+    static_assert(std::is_same_v<T, uint64_t>, "unsupported arithmetic word type");
+    return gate_factory.make_arithmetic_64_output_gate_my(output_owner, wires);
+  }
+}
+
+// Typed dispatch to make_arithmetic_{8,16,32,64}_input_gate_other of the gate factory
+template <typename T>
+MOTION::WireVector make_arithmetic_input_gate_other(MOTION::GateFactory& gate_factory, std::size_t input_owner,
+                                                    std::size_t num_simd) {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return gate_factory.make_arithmetic_8_input_gate_other(input_owner, num_simd);
+  } else if constexpr (std::is_same_v<T, uint16_t>) {
+    return gate_factory.make_arithmetic_16_input_gate_other(input_owner, num_simd);
+  } else if constexpr (std::is_same_v<T, uint32_t>) {
+    return gate_factory.make_arithmetic_32_input_gate_other(input_owner, num_simd);
+  } else {
+    static_assert(std::is_same_v<T, uint64_t>, "unsupported arithmetic word type");
+    return gate_factory.make_arithmetic_64_input_gate_other(input_owner, num_simd);
+  }
+}
+
+// Balanced-tree reduction of `inputs` with the associative Boolean gate `op` (AND, OR or XOR)
+// Neighbouring pairs are combined level by level (an odd leftover wire moves up unchanged), so the
+// result has depth ceil(log2(inputs.size())) instead of inputs.size() - 1 for a left-to-right chain;
+// each AND/OR level costs one round trip in Boolean GMW
+// Every input must have the same number of SIMD lanes, the reduction is applied lane by lane
+MOTION::WireVector make_tree_reduction(MOTION::GateFactory& gate_factory, ENCRYPTO::PrimitiveOperationType op,
+                                       std::vector<MOTION::WireVector> inputs) {
+  if (op != ENCRYPTO::PrimitiveOperationType::AND && op != ENCRYPTO::PrimitiveOperationType::OR &&
+      op != ENCRYPTO::PrimitiveOperationType::XOR) {
+    throw std::invalid_argument("tree reduction supports AND, OR and XOR only");
+  }
+  if (inputs.empty()) {
+    throw std::invalid_argument("tree reduction needs at least one input");
+  }
+
+  while (inputs.size() > 1) {
+    std::vector<MOTION::WireVector> next_level;
+    next_level.reserve((inputs.size() + 1) / 2);
+    for (size_t i = 0; i + 1 < inputs.size(); i += 2) {
+      next_level.push_back(gate_factory.make_binary_gate(op, inputs[i], inputs[i + 1]));
+    }
+    if (inputs.size() % 2 == 1) {
+      next_level.push_back(std::move(inputs.back()));
+    }
+    inputs = std::move(next_level);
+  }
+  return std::move(inputs.front());
+}
+
+// Local lane split of a one-bit Boolean GMW wire with groups x width lanes (group-major)
+// XOR shares are lane-local, so regrouping lanes needs no interaction: a LocalGateRunner callback
+// copies the lower and the upper half of every group into two fresh wires of groups x
+// ceil(width / 2) lanes, padding the upper half of an odd group with shares of 0 (both parties hold 0)
+std::pair<MOTION::WireVector, MOTION::WireVector> make_lane_split(const MOTION::WireVector& input,
+                                                                  std::size_t groups, std::size_t width,
+                                                                  LocalGateRunner& local_gates) {
+  std::size_t half = (width + 1) / 2;
+  auto lower = std::make_shared<BooleanGMWWire>(groups * half);
+  auto upper = std::make_shared<BooleanGMWWire>(groups * half);
+  local_gates.add([&local_gates, input_wire = input.at(0), lower, upper, groups, width, half] {
+    local_gates.wait_online(input_wire);
+    const auto& bits = std::static_pointer_cast<BooleanGMWWire>(input_wire)->get_share();
+    auto& lower_bits = lower->get_share();
+    auto& upper_bits = upper->get_share();
+    for (std::size_t group = 0; group < groups; ++group) {
+      for (std::size_t i = 0; i < half; ++i) {
+        lower_bits.Set(bits.Get(group * width + i), group * half + i);
+        upper_bits.Set(half + i < width && bits.Get(group * width + half + i), group * half + i);
+      }
+    }
+    lower->set_online_ready();
+    upper->set_online_ready();
+  }, [lower, upper] {
+    lower->set_online_ready();
+    upper->set_online_ready();
+  });
+  return {{lower}, {upper}};
+}
+
+// Per-group OR over the lanes of a one-bit Boolean wire (groups x width lanes, group-major)
+// Each level halves the lanes with a local split and one SIMD OR gate over all groups, so the
+// result (one lane per group) has depth ceil(log2(width)); each level costs one round in GMW
+MOTION::WireVector make_lane_or_reduction(MOTION::GateFactory& gate_factory, MOTION::WireVector input,
+                                          std::size_t groups, std::size_t width, LocalGateRunner& local_gates) {
+  while (width > 1) {
+    auto [lower, upper] = make_lane_split(input, groups, width, local_gates);
+    input = gate_factory.make_binary_gate(ENCRYPTO::PrimitiveOperationType::OR, lower, upper);
+    width = (width + 1) / 2;
+  }
+  return input;
+}
+
+// Per-group number of set lanes of a one-bit Boolean wire, as an arithmetic share of type C
+// Every lane bit is zero-extended to C bits (bit 0 is the lane bit, all higher bits a wire of zero
+// shares), converted with one B2A into an ArithmeticGMWWire<C> and summed locally per group:
+// the sum of additive shares is a share of the sum
+template <typename C>
+MOTION::WireVector make_lane_count(MOTION::TwoPartyBackend& backend, const MOTION::WireVector& input,
+                                   std::size_t groups, std::size_t width, LocalGateRunner& local_gates) {
+  auto zeros = std::make_shared<BooleanGMWWire>(groups * width);
+  local_gates.add([zeros] { zeros->set_online_ready(); });
+  MOTION::WireVector bits(8 * sizeof(C), zeros);
+  bits[0] = input.at(0);
+  auto lanes = backend.convert(MOTION::MPCProtocol::ArithmeticGMW, bits);
+
+  auto counts = std::make_shared<ArithmeticGMWWire<C>>(groups);
+  local_gates.add([&local_gates, lane_wire = lanes.at(0), counts, groups, width] {
+    local_gates.wait_online(lane_wire);
+    const auto& lane_shares = std::static_pointer_cast<ArithmeticGMWWire<C>>(lane_wire)->get_share();
+    auto& count_shares = counts->get_share();
+    count_shares.assign(groups, 0);
+    for (std::size_t group = 0; group < groups; ++group) {
+      C sum = 0;
+      for (std::size_t i = 0; i < width; ++i) {
+        sum += lane_shares[group * width + i];
+      }
+      count_shares[group] = sum;
+    }
+    counts->set_online_ready();
+  }, [counts, groups] {
+    counts->get_share().assign(groups, 0);
+    counts->set_online_ready();
+  });
+  return {counts};
+}
+
+
+// Small-domain zero test input: the HAM outputs of T words, reduced to Z_{2^8} shares
+// A weight w <= 8 * sizeof(T) < 2^8 survives the reduction of both additive shares, since
+// (x0 mod 2^8 + x1 mod 2^8) mod 2^8 = w mod 2^8 = w, so the DPF after it needs keys for a
+// dpf_domain_bits domain only instead of the full word ring (a depth 8 instead of 64 tree)
+// This only narrows the domain of the existing tree DPF; a table-based (one-hot) zero-test gate for
+// such small domains would need its own key generation in the FSS backend and is not implemented here
+// One local gate narrows all word planes; uint8_t words are already in the small domain
+// Throws std::invalid_argument if a HAM output is not an arithmetic wire of T
+template <typename T>
+std::vector<MOTION::WireVector> narrow_ham_outputs(const WireTable& ham_outputs, LocalGateRunner& local_gates) {
+  static_assert(8 * sizeof(T) < (std::size_t{1} << dpf_domain_bits), "HAM output exceeds the DPF domain");
+  std::vector<MOTION::WireVector> narrowed(ham_outputs.rows());
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    for (std::size_t word_pos = 0; word_pos < ham_outputs.rows(); ++word_pos) {
+      narrowed[word_pos] = ham_outputs.get(word_pos);
+    }
+  } else {
+    std::vector<std::shared_ptr<ArithmeticGMWWire<T>>> wide_wires;
+    std::vector<std::shared_ptr<ArithmeticGMWWire<uint8_t>>> narrow_wires;
+    for (std::size_t word_pos = 0; word_pos < ham_outputs.rows(); ++word_pos) {
+      auto wide = std::dynamic_pointer_cast<ArithmeticGMWWire<T>>(ham_outputs.get(word_pos).at(0));
+      if (!wide) {
+        throw std::invalid_argument("narrow_ham_outputs: HAM output of word " + std::to_string(word_pos) +
+                                    " is not an arithmetic wire of " + std::to_string(8 * sizeof(T)) + " bits");
+      }
+      auto narrow = std::make_shared<ArithmeticGMWWire<uint8_t>>(wide->get_num_simd());
+      wide_wires.push_back(wide);
+      narrow_wires.push_back(narrow);
+      narrowed[word_pos] = {narrow};
+    }
+    // Planes before `narrowed_planes` are online, an abort releases the rest as zero shares
+    auto narrowed_planes = std::make_shared<std::size_t>(0);
+    local_gates.add([&local_gates, wide_wires = std::move(wide_wires), narrow_wires, narrowed_planes] {
+      for (std::size_t word_pos = 0; word_pos < wide_wires.size(); ++word_pos) {
+        *narrowed_planes = word_pos;
+        local_gates.wait_online(MOTION::NewWireP(wide_wires[word_pos]));
+        const auto& shares = wide_wires[word_pos]->get_share();
+        auto& narrow_shares = narrow_wires[word_pos]->get_share();
+        narrow_shares.resize(shares.size());
+        std::transform(shares.begin(), shares.end(), narrow_shares.begin(),
+                       [](T share) { return static_cast<uint8_t>(share); });
+        narrow_wires[word_pos]->set_online_ready();
+      }
+      *narrowed_planes = wide_wires.size();
+    }, [narrow_wires, narrowed_planes] {
+      for (std::size_t word_pos = *narrowed_planes; word_pos < narrow_wires.size(); ++word_pos) {
+        narrow_wires[word_pos]->get_share().assign(narrow_wires[word_pos]->get_num_simd(), 0);
+        narrow_wires[word_pos]->set_online_ready();
+      }
+    });
+  }
+  return narrowed;
+}
+
+// Hashes are shared and compared as words of type T (--hash-word-bits): a 256-bit hash is
+// 32 x uint8_t, 8 x uint32_t or 4 x uint64_t words, a 64-bit one (--fingerprint-bits 64) 1 x uint64_t
+template <typename T>
+struct SecretShareHash {
+    // Word-plane layout: plane k is ONE SIMD input holding word k of every window's hash
+    // (num_simd = num_lanes), so the number of gates does not depend on the number of windows
+    // and every later step stays an element-wise SIMD operation over those windows
+    // With a pattern batch there is one lane per (pattern, window): lane = pattern * num_windows + window
+    size_t num_lanes = 0;
+
+    WireTable my_hash_wires;  // hash_words x 1: get(word_pos)
+    std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<T>>> my_hash_promises;  // [word_pos]
     
-    // TEXT DATA: Individual secret sharing for each character in each sliding window
-    // - For text "HELLO" with pattern_size=3: 3 windows, each with 3 characters
-    // - Window 1: ['H','E','L'], Window 2: ['E','L','L'], Window 3: ['L','L','O']
+    // For receiving other party's hash shares
+    WireTable other_hash_wires;  // hash_words x 1: get(word_pos)
+};
+
+// Revealed aggregate of the match bits, depending on --result-mode (both parties learn it)
+struct MatchResultOutputs {
+  ResultMode mode = ResultMode::shares;
+  ENCRYPTO::ReusableFiberFuture<MOTION::BitValues> bits;  // any: a lane per pattern, positions: every lane
+  std::function<std::vector<std::uint64_t>()> counts;     // count: one per pattern
+};
+
+struct HAMDPFCircuit {
+    size_t num_windows = 0;    // windows per pattern
+    size_t num_patterns = 1;   // lanes are pattern-major: lane = pattern * num_windows + window
+    size_t window_offset = 0;  // index of the first window in the query (chunked evaluation)
+
+    // HAM output wires (Hamming distances for one word position of all hash pairs)
+    WireTable ham_outputs;  // hash_words x 1: get(word_pos), SIMD over hash pairs
     
-    std::vector<std::vector<MOTION::WireVector>> text_window_wires; 
-    // ↳ 2D structure: text_window_wires[window][position]
-    // ↳ text_window_wires[0][0] = wire for 1st character of 1st window ('H')
-    // ↳ text_window_wires[1][2] = wire for 3rd character of 2nd window ('L')
+    // DPF output wires (equality check results for one word position of all hash pairs)  
+    WireTable dpf_outputs;  // hash_words x 1: get(word_pos), SIMD over hash pairs
     
-    std::vector<std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>>>> text_window_promises;
-    // ↳ 2D structure: text_window_promises[window][position]
-    // ↳ text_window_promises[0][0].set_value({72}) feeds 'H' from window 1
-    // ↳ Each promise provides one ASCII character to the secret sharing process
+    // Final results: SIMD lane w indicates if hash pair w is equal
+    MOTION::WireVector final_results;
+
+    // Output gates of the requested aggregate (nothing in ResultMode::shares)
+    MatchResultOutputs outputs;
+
+    // --result-mode any / count: the chunk's aggregate, still shared (revealed per query, see
+    // QueryResultAggregate)
+    MOTION::WireVector aggregate;
 };
 
-// Create input wires with individual character secret sharing
-// This function sets up the MPC input gates for both parties based on their roles
-auto create_circuit_inputs(const Options& options, MOTION::TwoPartyBackend& backend) {
+
+template <typename T>
+SecretShareHash<T> create_hash_ss_circuit_inputs(const Options& options, MOTION::TwoPartyBackend& backend) {
   auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
   
-  SecretSharedData shared_data;
-  size_t num_windows = options.text_size - options.pattern_size + 1;  // Number of sliding windows
+  // Shape comes from the options, so the circuit can also be built with --no-run (empty hashes)
+  SecretShareHash<T> shared_hash;
+  size_t number_of_hashes = options.num_patterns * (options.text_size - options.pattern_size + 1);
+  size_t hash_words = compare_words(options);
+  shared_hash.num_lanes = number_of_hashes;
   
-  if (options.role == "pattern_holder") {
-    // PATTERN HOLDER: Creates input gates for their own pattern, receives gates for other's text
+  shared_hash.my_hash_wires = WireTable(hash_words, 1);
+  shared_hash.my_hash_promises.resize(hash_words);
+  shared_hash.other_hash_wires = WireTable(hash_words, 1);
+
+  for (size_t word_pos = 0; word_pos < hash_words; ++word_pos) {
+    // Both parties create the input gate of party 0 first, then the one of party 1
+    for (size_t input_owner = 0; input_owner < 2; ++input_owner) {
+      if (input_owner == options.my_id) {
+        auto pair = make_arithmetic_input_gate_my<T>(gate_factory, options.my_id, number_of_hashes);
+        shared_hash.my_hash_promises[word_pos] = std::move(pair.first);
+        shared_hash.my_hash_wires.set(word_pos, 0, pair.second);
+      } else {
+        shared_hash.other_hash_wires.set(
+            word_pos, 0, make_arithmetic_input_gate_other<T>(gate_factory, input_owner, number_of_hashes));
+      }
+    }
+  }
+
+  return shared_hash;
+}
+
+
+template <typename T>
+void print_secret_shared_hash_details(const Options& options, const SecretShareHash<T>& shared_hash, const StringProcessing::WindowHashes& original_hashes) {
+  std::cout << "\n=== HASH SECRET SHARING DETAILS ===" << std::endl;
+  size_t number_of_hashes = original_hashes.size();
+  size_t hash_words = shared_hash.my_hash_wires.rows();
+
+  for (size_t word_pos = 0; word_pos < hash_words; ++word_pos) {
+    auto share_values = ShareKernels::get_share_span<T>(shared_hash.my_hash_wires.wire(word_pos));
+    auto received_values = ShareKernels::get_share_span<T>(shared_hash.other_hash_wires.wire(word_pos));
+    std::vector<T> original_words = StringProcessing::hash_word_plane<T>(original_hashes, word_pos);
+
+    for (size_t hash_no = 0; hash_no < number_of_hashes; ++hash_no) {
+      T original_word = original_words[hash_no];
+      T my_share = share_values[hash_no];
+      T sent_share = original_word - my_share;
+      T received_share = received_values[hash_no];
+      
+      std::cout << "Hash " << hash_no << " Word[" << word_pos << "] = " << (uint64_t)original_word << ": \n";
+      std::cout << "\tMy share = " << (uint64_t)my_share << '\n'
+                << "\tSent share = " << (uint64_t)sent_share << '\n'
+                << "\tReceived share = " << (uint64_t)received_share << std::endl;
+    }
+  }
+}
+
+
+template <typename T>
+HAMDPFCircuit create_ham_dpf_circuit(const Options& options, MOTION::TwoPartyBackend& backend,
+                                     const SecretShareHash<T>& shared_hash, LocalGateRunner& local_gates) {
+  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
+  
+  HAMDPFCircuit ham_dpf_circuit;
+  size_t num_hashes = shared_hash.num_lanes;
+  size_t hash_words = shared_hash.my_hash_wires.rows();  // One SIMD plane per T-sized hash word
+  ham_dpf_circuit.num_patterns = options.num_patterns;
+  ham_dpf_circuit.num_windows = num_hashes / options.num_patterns;
+  
+  if (options.verbose) {
+    std::cout << "\n=== Creating HAM+DPF Circuit for " << num_hashes << " hash pairs ("
+              << hash_words << " x " << 8 * sizeof(T) << "-bit words) ===" << std::endl;
+  }
+  
+  // Initialize circuit structures
+  ham_dpf_circuit.ham_outputs = WireTable(hash_words, 1);
+  ham_dpf_circuit.dpf_outputs = WireTable(hash_words, 1);
+  
+  // Each gate below processes one word position of all hash pairs at once (h0==h0', h1==h1', etc.)
+  for (size_t word_pos = 0; word_pos < hash_words; ++word_pos) {
     
-    // Create individual input gates for each pattern character (OWN DATA)
-    // Each gate produces a [promise, wire] pair for one character
-    shared_data.pattern_char_wires.resize(options.pattern_size);
-    shared_data.pattern_char_promises.resize(options.pattern_size);
+    // Step 2: Calculate difference SS(h0) - SS(h1) using NEG + ADD gates
+    // h0 / h1 are the hashes input by party 0 / 1: both parties subtract in that owner order, so
+    // their shares add up to h0 - h1 (a party-relative my - other would not be a sharing of it)
+    const auto& owner0_hash = options.my_id == 0 ? shared_hash.my_hash_wires : shared_hash.other_hash_wires;
+    const auto& owner1_hash = options.my_id == 0 ? shared_hash.other_hash_wires : shared_hash.my_hash_wires;
+
+    // NEG gate: -SS(h1)
+    auto neg_owner1_hash = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::NEG,
+                                                        owner1_hash.get(word_pos));
+
+    // ADD gate: SS(h0) + (-SS(h1)) = SS(h0 - h1)
+    auto hash_difference = gate_factory.make_binary_gate(ENCRYPTO::PrimitiveOperationType::ADD,
+                                                        owner0_hash.get(word_pos), neg_owner1_hash);
     
-    for (size_t i = 0; i < options.pattern_size; ++i) {
-      // make_arithmetic_8_input_gate_my() creates an input gate for data WE own
-      // Returns: std::pair<Promise, WireVector>
-      // - Promise (first): Input mechanism to provide our secret ASCII value
-      // - WireVector (second): Output wire that will contain our share of the value
-      auto pattern_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
-      shared_data.pattern_char_promises[i] = std::move(pattern_pair.first);   // Input side
-      shared_data.pattern_char_wires[i] = std::move(pattern_pair.second);     // Output side
+    // Steps 3-5: HAM gate (generates random mask, publishes a+r, computes Hamming distance)
+    auto hamming_distance = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::HAM, 
+                                                        hash_difference);
+    ham_dpf_circuit.ham_outputs.set(word_pos, 0, hamming_distance);
+  }
+
+  // Step 6: DPF gate (equality check: HD==0?) over the small domain of the Hamming distances
+  auto dpf_inputs = narrow_ham_outputs<T>(ham_dpf_circuit.ham_outputs, local_gates);
+  for (size_t word_pos = 0; word_pos < hash_words; ++word_pos) {
+    auto is_equal = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::DPF, dpf_inputs[word_pos]);
+    ham_dpf_circuit.dpf_outputs.set(word_pos, 0, is_equal);
+  }
+  
+  // Combine all word equality results with a balanced AND tree, lane by lane
+  // All words must be equal for the hashes to be equal
+  ham_dpf_circuit.final_results = make_tree_reduction(gate_factory, ENCRYPTO::PrimitiveOperationType::AND,
+                                                      ham_dpf_circuit.dpf_outputs.entries());
+  if (options.verbose) {
+    std::cout << "  Final result: AND tree over all " << hash_words << " word equality checks ("
+              << static_cast<size_t>(std::ceil(std::log2(hash_words))) << " AND layers)" << std::endl;
+    std::cout << "HAM+DPF circuit creation complete!" << std::endl;
+  }
+  return ham_dpf_circuit;
+}
+
+// Reveal per-pattern counts of type C to both parties
+template <typename C>
+std::function<std::vector<std::uint64_t>()> make_count_output(MOTION::GateFactory& gate_factory,
+                                                              const MOTION::WireVector& counts) {
+  auto future = std::make_shared<ENCRYPTO::ReusableFiberFuture<MOTION::IntegerValues<C>>>(
+      make_arithmetic_output_gate_my<C>(gate_factory, MOTION::ALL_PARTIES, counts));
+  return [future] {
+    auto values = future->get();
+    return std::vector<std::uint64_t>(values.begin(), values.end());
+  };
+}
+
+// Per-group sum of arithmetic share wires of type C with `groups` lanes each
+// Additive shares add up locally, so the sum is one LocalGateRunner callback without interaction
+template <typename C>
+MOTION::WireVector make_count_sum(const std::vector<MOTION::WireVector>& inputs, std::size_t groups,
+                                  LocalGateRunner& local_gates) {
+  if (inputs.size() == 1) {
+    return inputs.front();
+  }
+  std::vector<MOTION::NewWireP> input_wires;
+  for (const auto& input : inputs) {
+    input_wires.push_back(input.at(0));
+  }
+  auto sum = std::make_shared<ArithmeticGMWWire<C>>(groups);
+  local_gates.add([&local_gates, input_wires, sum, groups] {
+    auto& sum_shares = sum->get_share();
+    sum_shares.assign(groups, 0);
+    for (const auto& wire : input_wires) {
+      local_gates.wait_online(wire);
+      const auto& shares = std::static_pointer_cast<ArithmeticGMWWire<C>>(wire)->get_share();
+      for (std::size_t group = 0; group < groups; ++group) {
+        sum_shares[group] += shares[group];
+      }
     }
-    
-    // Create receiver gates for text character shares from the other party (OTHER'S DATA)
-    shared_data.text_window_wires.resize(num_windows);
-    for (size_t window = 0; window < num_windows; ++window) {
-      shared_data.text_window_wires[window].resize(options.pattern_size);
-      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
-        // make_arithmetic_8_input_gate_other() creates a receiver gate for data THEY own
-        // Returns: WireVector (no promise since we don't provide the input)
-        // This wire will receive the share of the other party's character
-        shared_data.text_window_wires[window][pos] = 
-            gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1);
+    sum->set_online_ready();
+  }, [sum, groups] {
+    sum->get_share().assign(groups, 0);
+    sum->set_online_ready();
+  });
+  return {sum};
+}
+
+// Reduce the match bits of one chunk to the aggregate of --result-mode in the circuit:
+// any = per-pattern OR tree over the window lanes, count = per-pattern sum after B2A in words of
+// count_bits (sized for the whole query), both kept shared in `aggregate` and revealed once per
+// query by QueryResultAggregate; positions reveals every window lane of the chunk
+void make_result_outputs(const Options& options, MOTION::TwoPartyBackend& backend, HAMDPFCircuit& ham_dpf_circuit,
+                         std::size_t count_bits, LocalGateRunner& local_gates) {
+  auto& gate_factory = backend.get_gate_factory(options.boolean_protocol);
+  auto& outputs = ham_dpf_circuit.outputs;
+  outputs.mode = options.result_mode;
+  const auto& bits = ham_dpf_circuit.final_results;
+  std::size_t groups = ham_dpf_circuit.num_patterns;
+  std::size_t width = ham_dpf_circuit.num_windows;
+
+  switch (options.result_mode) {
+    case ResultMode::shares:
+      break;
+    case ResultMode::any:
+      ham_dpf_circuit.aggregate = make_lane_or_reduction(gate_factory, bits, groups, width, local_gates);
+      break;
+    case ResultMode::count:
+      switch (count_bits) {
+        case 8: ham_dpf_circuit.aggregate = make_lane_count<uint8_t>(backend, bits, groups, width, local_gates); break;
+        case 16: ham_dpf_circuit.aggregate = make_lane_count<uint16_t>(backend, bits, groups, width, local_gates); break;
+        case 32: ham_dpf_circuit.aggregate = make_lane_count<uint32_t>(backend, bits, groups, width, local_gates); break;
+        default: ham_dpf_circuit.aggregate = make_lane_count<uint64_t>(backend, bits, groups, width, local_gates); break;
+      }
+      break;
+    case ResultMode::positions:
+      outputs.bits = gate_factory.make_boolean_output_gate_my(MOTION::ALL_PARTIES, ham_dpf_circuit.final_results);
+      break;
+  }
+}
+
+// --json: one line with the revealed aggregate of every pattern, per chunk for positions and per
+// query for any / count (window_offset 0, all windows); nothing in shares mode
+// {"query_id": 0, "window_offset": 0, "num_windows": 97, "result_mode": "any", "results": [true, false]}
+// results holds a bool (any), a count (count) or the window indices (positions) per pattern
+void print_match_results_json(const Options& options, HAMDPFCircuit& ham_dpf_circuit) {
+  const auto& outputs = ham_dpf_circuit.outputs;
+  if (options.no_run || outputs.mode == ResultMode::shares) {
+    return;
+  }
+
+  boost::json::array results;
+  if (outputs.mode == ResultMode::count) {
+    for (auto count : outputs.counts()) {
+      results.emplace_back(count);
+    }
+  } else {
+    auto revealed_bits = ham_dpf_circuit.outputs.bits.get();
+    for (size_t k = 0; k < ham_dpf_circuit.num_patterns; ++k) {
+      if (outputs.mode == ResultMode::any) {
+        results.emplace_back(revealed_bits.at(0).Get(k));
+        continue;
       }
+      boost::json::array positions;
+      for (size_t hash_no = 0; hash_no < ham_dpf_circuit.num_windows; ++hash_no) {
+        if (revealed_bits.at(0).Get(k * ham_dpf_circuit.num_windows + hash_no)) {
+          positions.emplace_back(ham_dpf_circuit.window_offset + hash_no);
+        }
+      }
+      results.emplace_back(std::move(positions));
     }
-    
-  } else if (options.role == "text_holder") {
-    // TEXT HOLDER: Receives gates for other's pattern, creates input gates for their own text
-    
-    // Create receiver gates for pattern character shares from the other party (OTHER'S DATA)
-    shared_data.pattern_char_wires.resize(options.pattern_size);
-    for (size_t i = 0; i < options.pattern_size; ++i) {
-      // Receive shares of pattern holder's characters
-      shared_data.pattern_char_wires[i] = 
-          gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1);
+  }
+
+  static const char* mode_names[] = {"shares", "any", "count", "positions"};
+  boost::json::object obj;
+  obj.emplace("query_id", options.query_id);
+  obj.emplace("window_offset", ham_dpf_circuit.window_offset);
+  obj.emplace("num_windows", ham_dpf_circuit.num_windows);
+  obj.emplace("result_mode", mode_names[static_cast<std::size_t>(outputs.mode)]);
+  obj.emplace("results", std::move(results));
+  std::cout << obj << "\n";
+}
+
+void print_ham_dpf_results(const Options& options, HAMDPFCircuit& ham_dpf_circuit) {
+  if (options.no_run || options.json) {
+    return;
+  }
+
+  std::cout << "\n=== HAM+DPF Results ===" << std::endl;
+
+  const auto& outputs = ham_dpf_circuit.outputs;
+  auto print_final_result = [&](const std::string& pattern_name, bool pattern_found) {
+    std::cout << "\n🎯 FINAL PATTERN MATCHING RESULT" << pattern_name;
+    if (options.chunk_windows != 0) {
+      std::cout << " (windows " << ham_dpf_circuit.window_offset << "-"
+                << ham_dpf_circuit.window_offset + ham_dpf_circuit.num_windows - 1 << ")";
     }
-    
-    // Create individual input gates for each text character in each window (OWN DATA)
-    shared_data.text_window_wires.resize(num_windows);
-    shared_data.text_window_promises.resize(num_windows);
-    
-    for (size_t window = 0; window < num_windows; ++window) {
-      shared_data.text_window_wires[window].resize(options.pattern_size);
-      shared_data.text_window_promises[window].resize(options.pattern_size);
-      
-      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
-        // Create input gate for our text character at this window position
-        auto text_pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
-        shared_data.text_window_promises[window][pos] = std::move(text_pair.first);  // Input side
-        shared_data.text_window_wires[window][pos] = std::move(text_pair.second);    // Output side
+    std::cout << ": " << (pattern_found ? "PATTERN FOUND! 🎉" : "PATTERN NOT FOUND 😞") << std::endl;
+  };
+
+  // Revealed aggregates: only what --result-mode asked for is known to either party
+  if (outputs.mode != ResultMode::shares) {
+    MOTION::BitValues revealed_bits;
+    std::vector<std::uint64_t> counts;
+    if (outputs.mode == ResultMode::count) {
+      counts = outputs.counts();
+    } else {
+      revealed_bits = ham_dpf_circuit.outputs.bits.get();
+    }
+
+    for (size_t k = 0; k < ham_dpf_circuit.num_patterns; ++k) {
+      std::string pattern_name = ham_dpf_circuit.num_patterns > 1 ? " P" + std::to_string(k + 1) : "";
+      bool pattern_found = false;
+      if (outputs.mode == ResultMode::any) {
+        pattern_found = revealed_bits.at(0).Get(k);
+      } else if (outputs.mode == ResultMode::count) {
+        std::cout << "Matching windows" << pattern_name << ": " << counts.at(k) << std::endl;
+        pattern_found = counts.at(k) != 0;
+      } else {
+        std::cout << "Match positions" << pattern_name << ":";
+        for (size_t hash_no = 0; hash_no < ham_dpf_circuit.num_windows; ++hash_no) {
+          if (revealed_bits.at(0).Get(k * ham_dpf_circuit.num_windows + hash_no)) {
+            std::cout << " " << ham_dpf_circuit.window_offset + hash_no;
+            pattern_found = true;
+          }
+        }
+        std::cout << std::endl;
       }
+      print_final_result(pattern_name, pattern_found);
     }
+    return;
+  }
+
+  // One SIMD lane per hash pair
+  auto result_wire = std::static_pointer_cast<BooleanGMWWire>(ham_dpf_circuit.final_results[0]);
+  const auto& result_bits = result_wire->get_share();
+
+  // Results per pattern of the batch (a single pattern is reported as before)
+  for (size_t k = 0; k < ham_dpf_circuit.num_patterns; ++k) {
+    std::string pattern_name = ham_dpf_circuit.num_patterns > 1 ? " P" + std::to_string(k + 1) : "";
+    size_t first_lane = k * ham_dpf_circuit.num_windows;
+
+    // Display results for each hash pair
+    for (size_t hash_no = 0; hash_no < ham_dpf_circuit.num_windows; ++hash_no) {
+      bool is_equal = result_bits.Get(first_lane + hash_no);
+
+      std::cout << "Hash pair" << pattern_name << " " << ham_dpf_circuit.window_offset + hash_no << ": "
+                << (is_equal ? "EQUAL(666)" : "NOT EQUAL(die)") << std::endl;
+    }
+
+    bool pattern_found = false;
+    for (size_t hash_no = 0; hash_no < ham_dpf_circuit.num_windows; ++hash_no) {
+      if (result_bits.Get(first_lane + hash_no)) {
+        pattern_found = true;
+        break;
+      }
+    }
+    print_final_result(pattern_name, pattern_found);
   }
-  
-  return shared_data;
 }
 
-// Function to extract and display share values with both kept and sent shares
-// This function demonstrates how to access the actual cryptographic shares after circuit execution
-void print_share_details(const Options& options, const SecretSharedData& shared_data, 
-                        const std::vector<uint8_t>* pattern_values = nullptr,
-                        const std::vector<std::vector<uint8_t>>* text_values = nullptr) {
-  
-  size_t num_windows = options.text_size - options.pattern_size + 1;
-  std::cout << "\n\n\n" << std::endl;
+
+// Provide actual input values based on role using individual character sharing
+void provide_circuit_inputs(const Options& options, SecretSharedData& shared_data,
+                            const std::vector<uint8_t>& pattern_values,
+                            const std::vector<uint8_t>& text_values,
+                            const StringProcessing::SlidingWindows& text_windows) {
   if (options.role == "pattern_holder") {
-    std::cout << "=== MY PATTERN SHARES (Owned) ===" << std::endl;
-    // SHARE EXTRACTION: Access the actual secret shares from owned pattern wires
-    for (size_t i = 0; i < options.pattern_size; ++i) {
-      // WIRE ACCESS: Cast generic NewWire to specific ArithmeticGMWWire to access share data
-      // shared_data.pattern_char_wires[i][0] gets the first (and only) wire in the vector
-      auto gmw_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.pattern_char_wires[i][0]);
-      
-      // SHARE EXTRACTION: Get the actual share vector and extract the single value [0]
-      // share_values[0] contains the uint8_t share this party holds
-      auto share_values = gmw_wire->get_share();
-      
-      char original_char = static_cast<char>((*pattern_values)[i]);
-      uint8_t original_value = (*pattern_values)[i];
-      uint8_t my_share = share_values[0];  // The cryptographic share we keep
+    // PROMISE FULFILLMENT: Feed actual ASCII values into the secret sharing mechanism
+    // Each promise.set_value() triggers the generation of secret shares
+    if (options.simd_inputs) {
+      // SIMD INPUT MODE: the whole pattern goes through a single promise
+      shared_data.pattern_promise.set_value(pattern_values);
+    }
+    for (size_t i = 0; !options.simd_inputs && i < pattern_values.size(); ++i) {
+      // Wrap single ASCII value in vector (SIMD size 1)
+      std::vector<uint8_t> single_char = {pattern_values[i]};
       
-      // SENT SHARE CALCULATION: In GMW, sent_share + my_share = original_value (mod 2^8)
-      // This shows what we sent to the other party to complete the secret sharing
-      uint8_t sent_share = original_value - my_share;  // What we sent to the other party
+      // CRITICAL: This triggers secret sharing for character i
+      // The framework will:
+      // 1. Generate a random share for this party
+      // 2. Calculate and send complementary share to other party
+      // 3. Store this party's share in the corresponding wire
+      shared_data.pattern_char_promises[i].set_value(single_char);
       
-      std::cout << "P[" << i << "] = '" << original_char << "' (" << (int)original_value 
-                << "): My share = " << (int)my_share << ", Sent share = " << (int)sent_share << std::endl;
-    }
-    
-    std::cout << "\n=== RECEIVED TEXT SHARES ===" << std::endl;
-    // RECEIVED SHARES: Display shares we received from the text holder
-    for (size_t window = 0; window < num_windows; ++window) {
-      std::cout << "Window T" << (window + 1) << ":" << std::endl;
-      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
-        // WIRE ACCESS: Get the wire that received the other party's text character share
-        auto gmw_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.text_window_wires[window][pos][0]);
-        auto share_values = gmw_wire->get_share();
-        
-        // RECEIVED SHARE: This is the share the text holder sent us
-        // We cannot reconstruct the original value since we only have one share
-        std::cout << "  T" << (window + 1) << "[" << pos << "]: Received share = " 
-                  << (int)share_values[0] << std::endl;
-      }
+      // Example: For 'H' (ASCII 72):
+      // - Framework generates random value: 123
+      // - Calculates sent share: 72 - 123 = 205 (mod 2^8)  
+      // - Stores 123 in pattern_char_wires.wire(0, i)
+      // - Sends 205 to text holder
     }
     
   } else if (options.role == "text_holder") {
-    std::cout << "=== RECEIVED PATTERN SHARES ===" << std::endl;
-    // RECEIVED SHARES: Display shares we received from the pattern holder
-    for (size_t i = 0; i < options.pattern_size; ++i) {
-      // WIRE ACCESS: Get the wire that received the other party's pattern character share
-      auto gmw_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.pattern_char_wires[i][0]);
-      auto share_values = gmw_wire->get_share();
-      
-      // RECEIVED SHARE: This is the share the pattern holder sent us
-      // We cannot reconstruct the original character since we only have one share
-      std::cout << "P[" << i << "]: Received share = " << (int)share_values[0] << std::endl;
-    }
-    
-    std::cout << "\n=== MY TEXT SHARES (Owned) ===" << std::endl;
-    // SHARE EXTRACTION: Access the actual secret shares from owned text wires  
-    for (size_t window = 0; window < num_windows; ++window) {
-      std::cout << "Window T" << (window + 1) << ":" << std::endl;
-      for (size_t pos = 0; pos < options.pattern_size; ++pos) {
-        // WIRE ACCESS: Cast and access the share data for this window position
-        auto gmw_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.text_window_wires[window][pos][0]);
-        auto share_values = gmw_wire->get_share();
-        
-        char original_char = static_cast<char>((*text_values)[window][pos]);
-        uint8_t original_value = (*text_values)[window][pos];
-        uint8_t my_share = share_values[0];  // The cryptographic share we keep
+    // PROMISE FULFILLMENT: Feed actual ASCII values for each character in each window
+    if (options.simd_inputs) {
+      // SIMD INPUT MODE: each text character is shared exactly once, windows are views on top
+      shared_data.text_promise.set_value(text_values);
+    }
+    for (size_t window = 0; !options.simd_inputs && window < text_windows.size(); ++window) {
+      for (size_t pos = 0; pos < text_windows[window].size(); ++pos) {
+        // Wrap single ASCII value in vector (SIMD size 1)
+        std::vector<uint8_t> single_char = {text_windows[window][pos]};
         
-        // SENT SHARE CALCULATION: Show what we sent to complete the secret sharing
-        uint8_t sent_share = original_value - my_share;  // What we sent to the other party
+        // CRITICAL: This triggers secret sharing for this window position
+        // Same process as pattern holder but for text characters
+        shared_data.text_window_promises[window * options.pattern_size + pos].set_value(single_char);
         
-        std::cout << "  T" << (window + 1) << "[" << pos << "] = '" << original_char 
-                  << "' (" << (int)original_value << "): My share = " << (int)my_share 
-                  << ", Sent share = " << (int)sent_share << std::endl;
+        // Example: For 'E' (ASCII 69) in window 1, position 1:
+        // - Framework generates random value: 87
+        // - Calculates sent share: 69 - 87 = 238 (mod 2^8)
+        // - Stores 87 in text_window_wires.wire(1, 1)
+        // - Sends 238 to pattern holder
       }
     }
   }
 }
 
 
+// ---------- ROLLING FINGERPRINT MODE (--mode rolling) ----------
+// Both parties share the characters over Z_{2^B} (T = uint<B>_t) and compute their share of
+//   f_j = sum_i c_i * (t_{j+i} - p_i)  mod 2^B
+// locally: f is linear, so the local results already are additive shares of f_j and go straight into
+// one HAM/DPF zero test per window, without a second sharing round (Phase 2) or an AND tree
+// The coefficients c_i are pseudo-random from --rolling-seed. For a window that does not match, some
+// d_i = t_{j+i} - p_i is non-zero with |d_i| < 2^8, i.e. of 2-adic valuation at most 7, so c_i * d_i
+// hits any fixed value with probability <= 2^(7-B) and Pr[f_j = 0] <= 2^(7-B)
+// (powers c_i = r^i would give the O(1) Rabin-Karp update per window, but have no such bound mod 2^B:
+// Thue-Morse strings collide for every odd r)
+template <typename T>
+struct RollingFingerprintCircuit {
+  size_t num_lanes = 0;  // num_patterns * num_windows, pattern-major like the hash lanes
+
+  MOTION::WireVector pattern_wires;  // one SIMD input of num_patterns * pattern_size characters
+  MOTION::WireVector text_wires;     // one SIMD input of text_size characters
+  ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<T>> my_promise;  // input of this party's role
+
+  // Shares of f for all lanes, filled by a LocalGateRunner callback once both inputs are online
+  std::shared_ptr<ArithmeticGMWWire<T>> fingerprints;
+};
 
+// Fingerprint coefficients c_0 .. c_{m-1}, the same for both parties given the same seed
+template <typename T>
+std::vector<T> rolling_coefficients(std::uint64_t seed, size_t pattern_size) {
+  std::mt19937_64 generator(seed);
+  std::vector<T> coefficients(pattern_size);
+  for (auto& coefficient : coefficients) {
+    coefficient = static_cast<T>(generator());
+  }
+  return coefficients;
+}
 
+// Phase 1 of --mode rolling: the pattern gate first, the text gate second (as with --simd-inputs)
+template <typename T>
+RollingFingerprintCircuit<T> create_rolling_circuit_inputs(const Options& options, MOTION::TwoPartyBackend& backend) {
+  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
 
+  RollingFingerprintCircuit<T> circuit;
+  size_t pattern_chars = options.num_patterns * options.pattern_size;
+  circuit.num_lanes = options.num_patterns * (options.text_size - options.pattern_size + 1);
+  if (options.role == "pattern_holder") {
+    auto pattern_pair = make_arithmetic_input_gate_my<T>(gate_factory, options.my_id, pattern_chars);
+    circuit.my_promise = std::move(pattern_pair.first);
+    circuit.pattern_wires = std::move(pattern_pair.second);
+    circuit.text_wires = make_arithmetic_input_gate_other<T>(gate_factory, 1 - options.my_id, options.text_size);
+  } else {
+    circuit.pattern_wires = make_arithmetic_input_gate_other<T>(gate_factory, 1 - options.my_id, pattern_chars);
+    auto text_pair = make_arithmetic_input_gate_my<T>(gate_factory, options.my_id, options.text_size);
+    circuit.my_promise = std::move(text_pair.first);
+    circuit.text_wires = std::move(text_pair.second);
+  }
+  circuit.fingerprints = std::make_shared<ArithmeticGMWWire<T>>(circuit.num_lanes);
+  return circuit;
+}
 
+// Characters widened to the ring (each character is one element of Z_{2^B})
+template <typename T>
+void provide_rolling_circuit_inputs(RollingFingerprintCircuit<T>& circuit, const std::vector<uint8_t>& values) {
+  circuit.my_promise.set_value(std::vector<T>(values.begin(), values.end()));
+}
 
-std::vector<std::vector<uint8_t>> compute_difference_concat_hash(const Options& options, const SecretSharedData& shared_data) {
-
-  std::cout << "\n\n=== Computing differences ===" << std::endl;
+// This party's shares of f for all lanes: the text part sum_i c_i * t_{j+i} is the same for every
+// pattern and is accumulated once per window block (one axpy per pattern position, contiguous in j),
+// then each pattern's constant sum_i c_i * p_i is subtracted
+// Products are taken in at least unsigned int, so uint16_t operands do not overflow a signed int
+template <typename T>
+void compute_rolling_fingerprints(const Options& options, const RollingFingerprintCircuit<T>& circuit) {
+  using Wide = std::conditional_t<(sizeof(T) < sizeof(unsigned)), unsigned, T>;
   size_t num_windows = options.text_size - options.pattern_size + 1;
-  std::vector<std::vector<uint8_t>> window_hashes(num_windows);
-
-   for (size_t window = 0; window < num_windows; ++window) {
-    std::vector<uint8_t> curr_window_share_difference(options.pattern_size);
-    std::cout << "Window T" << (window + 1) << ":" << std::endl;
-
-    for (size_t pos = 0; pos < options.pattern_size; ++pos) {
-
-      // Retrieve self kept pattern shares
-      auto gmw_pattern_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.pattern_char_wires[pos][0]);
-      uint8_t pattern_char_share = gmw_pattern_wire->get_share()[0];
+  size_t pattern_size = options.pattern_size;
+  auto coefficients = rolling_coefficients<T>(options.rolling_seed, pattern_size);
+  auto text = ShareKernels::get_share_span<T>(circuit.text_wires);
+  auto pattern = ShareKernels::get_share_span<T>(circuit.pattern_wires);
+
+  std::vector<T> pattern_terms(options.num_patterns, 0);
+  for (size_t k = 0; k < options.num_patterns; ++k) {
+    for (size_t pos = 0; pos < pattern_size; ++pos) {
+      pattern_terms[k] += static_cast<T>(Wide(coefficients[pos]) * Wide(pattern[k * pattern_size + pos]));
+    }
+  }
 
-      // Retrieve other party's text character share
-      auto gmw_text_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_data.text_window_wires[window][pos][0]);
-      uint8_t text_char_share = gmw_text_wire->get_share()[0];
-      
-      std::cout << "  T" << (window + 1) << "[" << pos << "] - P[" << pos << "]: " << (int)text_char_share << " - " << (int)pattern_char_share << "\n";
-      uint8_t share_difference = text_char_share - pattern_char_share;
-      std::cout << "  Difference: " << (int)share_difference << '\n';
-
-      if (options.role == "pattern_holder") {
-        uint8_t negated = -share_difference;
-        std::cout << "  Negated: " << (int)negated << "\n";
-        curr_window_share_difference[pos] = negated;
-        
-      } else {
-        curr_window_share_difference[pos] = share_difference;
+  auto& fingerprints = circuit.fingerprints->get_share();
+  fingerprints.resize(circuit.num_lanes);
+  HostParallel::parallel_for(options.threads, num_windows, HostParallel::default_grain, [&](size_t begin, size_t end) {
+    T* out = fingerprints.data() + begin;
+    std::fill(out, out + (end - begin), T(0));
+    for (size_t pos = 0; pos < pattern_size; ++pos) {
+      const Wide coefficient = coefficients[pos];
+      const T* t = text.data + begin + pos;
+      for (size_t j = 0; j < end - begin; ++j) {
+        out[j] += static_cast<T>(coefficient * Wide(t[j]));
       }
-      std::cout << '\n';
     }
+    for (size_t k = options.num_patterns; k-- > 0;) {
+      T* lane = fingerprints.data() + k * num_windows + begin;
+      for (size_t j = 0; j < end - begin; ++j) {
+        lane[j] = out[j] - pattern_terms[k];
+      }
+    }
+  });
+}
 
+// Phase 3 of --mode rolling: HAM -> DPF on the fingerprint shares, one zero test per lane
+template <typename T>
+HAMDPFCircuit create_rolling_zero_test_circuit(const Options& options, MOTION::TwoPartyBackend& backend,
+                                               const RollingFingerprintCircuit<T>& rolling,
+                                               LocalGateRunner& local_gates) {
+  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
 
-    // NEW: Hash the difference vector
-    std::vector<uint8_t> hash_result = StringProcessing::hash_difference_vector(curr_window_share_difference);
-    window_hashes[window] = hash_result;  // Store for potential future secret sharing
-    
-    // Display results
-    std::string concatenated_shares = StringProcessing::concat_vector(curr_window_share_difference);
-    std::string hash_string = StringProcessing::concat_vector(hash_result);
-
-    std::cout << "\n  Concatenated: " << concatenated_shares << std::endl;
-    std::cout << "  Hash (256-bit): " << hash_string << std::endl;
-    std::cout << "  Full hash size: " << hash_result.size() << " bytes\n\n\n";
+  HAMDPFCircuit ham_dpf_circuit;
+  ham_dpf_circuit.num_patterns = options.num_patterns;
+  ham_dpf_circuit.num_windows = rolling.num_lanes / options.num_patterns;
+  ham_dpf_circuit.ham_outputs = WireTable(1, 1);
+  ham_dpf_circuit.dpf_outputs = WireTable(1, 1);
+
+  if (options.verbose) {
+    std::cout << "\n=== Creating HAM+DPF zero test for " << rolling.num_lanes << " " << 8 * sizeof(T)
+              << "-bit fingerprints ===" << std::endl;
   }
+  auto hamming_weight =
+      gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::HAM, MOTION::WireVector{rolling.fingerprints});
+  ham_dpf_circuit.ham_outputs.set(0, 0, hamming_weight);
+  auto dpf_input = narrow_ham_outputs<T>(ham_dpf_circuit.ham_outputs, local_gates).front();
+  auto is_zero = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::DPF, dpf_input);
+  ham_dpf_circuit.dpf_outputs.set(0, 0, is_zero);
+  ham_dpf_circuit.final_results = is_zero;
+  return ham_dpf_circuit;
+}
 
-  return window_hashes;
+// Options of one chunk: the windows [window_offset, window_offset + num_windows) of the query,
+// i.e. text characters [window_offset, window_offset + num_windows + pattern_size - 1)
+// `base` is the query options without the text, the text holder's slice is copied from `text`
+// (a mapped text is not copied, the chunk only moves its offset into the mapping)
+Options make_chunk_options(const Options& base, const std::string& text, std::size_t window_offset,
+                           std::size_t num_windows) {
+  Options chunk_options = base;
+  chunk_options.text_size = num_windows + base.pattern_size - 1;
+  if (base.role == "text_holder" && base.text_file) {
+    chunk_options.text_offset = base.text_offset + window_offset;
+  } else if (base.role == "text_holder") {
+    chunk_options.text = text.substr(window_offset, chunk_options.text_size);
+  }
+  return chunk_options;
 }
 
+// Circuit and host-side state of one chunk of a query, built into a shared backend
+template <typename T>
+struct ExactPMCircuit {
+  Options options;  // narrowed to this chunk
+  std::size_t window_offset = 0;
+  std::size_t count_bits = 64;  // --result-mode count: word size of the query's counts
 
+  SecretSharedData shared_data;
+  std::unique_ptr<ChunkWorkspace> workspace;      // from the WorkspacePool, returned after the run
+  StringProcessing::SlidingWindows text_windows;  // view into workspace->text_values
+  SecretShareHash<T> shared_hashes;
+  RollingFingerprintCircuit<T> rolling;  // --mode rolling instead of shared_data and shared_hashes
+  HAMDPFCircuit ham_dpf_circuit;
 
+  std::size_t hash_planes_provided = 0;  // Phase 2 promises the local hash has fulfilled
+  std::promise<void> local_hash_done;
+  std::future<void> local_hash_finished;
+};
 
+// Build all 3 phases of one chunk and provide its Phase 1 inputs
+// Phase 1 (character sharing) -> local difference + hash (LocalGateRunner callback) ->
+// Phase 2 (hash sharing as T-sized word planes) -> Phase 3 (NEG -> ADD -> HAM -> DPF -> AND)
+// --mode rolling: Phase 1 over Z_{2^B} -> local fingerprint (callback) -> Phase 3 (HAM -> DPF)
+template <typename T>
+void build_exact_pm_circuit(ExactPMCircuit<T>& circuit, MOTION::TwoPartyBackend& backend,
+                            LocalGateRunner& local_gates, StageTimings& timings) {
+  using clock = StageTimings::clock;
+  const Options& options = circuit.options;
+
+  // ---------- PHASE 1: CHARACTER SECRET SHARING (build circuit & set input) ----------
+  auto build_start = clock::now();
+  bool rolling = options.match_mode == MatchMode::rolling;
+  if (rolling) {
+    circuit.rolling = create_rolling_circuit_inputs<T>(options, backend);
+  } else {
+    circuit.shared_data = create_circuit_inputs(options, backend);
+  }
 
-std::vector<std::vector<uint8_t>> run_pattern_text_circuit(const Options& options, MOTION::TwoPartyBackend& backend, const SecretSharedData& shared_data,
-                                                          const std::vector<uint8_t>* pattern_values = nullptr,
-                                                          const std::vector<std::vector<uint8_t>>* text_values = nullptr) {
-  
-  std::vector<std::vector<uint8_t>> hashes {};
-  if (options.no_run) {
-    return hashes;
+  if (options.role == "pattern_holder" && options.pattern_file) {
+    // Mapped pattern: bytes go straight into the input buffer, without the per-character dumps
+    auto pattern = pattern_bytes(options);
+    circuit.workspace->pattern_values.assign(pattern.begin(), pattern.end());
+  } else if (options.role == "pattern_holder") {
+    // PATTERN HOLDER: Process and provide pattern characters for secret sharing
+    circuit.workspace->pattern_values = StringProcessing::pattern_holder(options.pattern, options.verbose);
+  } else if (options.role == "text_holder" && options.text_file) {
+    // Mapped text: the chunk's slice of the mapping is the input buffer, windows are views on it
+    auto text = text_bytes(options);
+    circuit.workspace->text_values.assign(text.begin(), text.end());
+    circuit.text_windows =
+        StringProcessing::create_sliding_windows(circuit.workspace->text_values, options.pattern_size);
+  } else if (options.role == "text_holder") {
+    // TEXT HOLDER: Process and provide text characters for secret sharing
+    circuit.workspace->text_values = StringProcessing::text_holder(options.text, options.pattern_size, options.verbose);
+    circuit.text_windows =
+        StringProcessing::create_sliding_windows(circuit.workspace->text_values, options.pattern_size);
+  }
+  if (rolling) {
+    provide_rolling_circuit_inputs(circuit.rolling, options.role == "pattern_holder"
+                                                        ? circuit.workspace->pattern_values
+                                                        : circuit.workspace->text_values);
+  } else {
+    provide_circuit_inputs(options, circuit.shared_data, circuit.workspace->pattern_values,
+                           circuit.workspace->text_values, circuit.text_windows);
+  }
+  timings.add("build_input_sharing", clock::now() - build_start);
+
+  if (rolling) {
+    // ---------- PHASE 3: ZERO TEST OF THE LOCALLY COMPUTED FINGERPRINTS (build circuit) ----------
+    build_start = clock::now();
+    circuit.ham_dpf_circuit = create_rolling_zero_test_circuit(options, backend, circuit.rolling, local_gates);
+    circuit.ham_dpf_circuit.window_offset = circuit.window_offset;
+    make_result_outputs(options, backend, circuit.ham_dpf_circuit, circuit.count_bits, local_gates);
+    timings.add("build_ham_dpf", clock::now() - build_start);
+    return;
   }
 
-  // Execute the circuit to complete the secret sharing process
-  backend.run();
-  
-  if (!options.json) {
-    std::cout << "\n=== Circuit Execution Summary ===" << std::endl;
-    std::cout << "Individual character secret sharing circuit executed successfully!" << std::endl;
-    
-    size_t num_windows = options.text_size - options.pattern_size + 1;
-    size_t total_pattern_chars = options.pattern_size;
-    size_t total_text_chars = num_windows * options.pattern_size;
-    
-    std::cout << "Pattern: " << total_pattern_chars << " individual character secrets shared" << std::endl;
-    std::cout << "Text: " << total_text_chars << " individual character secrets shared across " 
-              << num_windows << " windows" << std::endl;
-    std::cout << "Total individual secret sharings: " << (total_pattern_chars + total_text_chars) << std::endl;
-    
-    // Display actual share values after circuit execution
-    print_share_details(options, shared_data, pattern_values, text_values);
-    hashes = compute_difference_concat_hash(options, shared_data);
+  // ---------- PHASE 2: HASH SECRET SHARING (build circuit) ----------
+  if (options.verbose) {
+    std::cout << "\n=== Phase 2 - Hash secret sharing (build only) ===\n" << std::endl;
+  }
 
+  build_start = clock::now();
+  circuit.shared_hashes = create_hash_ss_circuit_inputs<T>(options, backend);
+  timings.add("build_hash_sharing", clock::now() - build_start);
 
-    std::cout << "\n\n\n=== All Hashes ===" << std::endl;
-    for (size_t window = 0; window < hashes.size(); ++window) {
-      std::cout << "  Hash " << window << ": " << StringProcessing::concat_vector(hashes[window]) << std::endl;
-    } 
+  // ---------- PHASE 3: HAM+DPF PATTERN MATCHING (build circuit) ----------
+  if (options.verbose) {
+    std::cout << "\n=== Phase 3 - HAM+DPF Pattern Matching (build only) ===\n" << std::endl;
   }
 
-  return hashes;
+  build_start = clock::now();
+  circuit.ham_dpf_circuit = create_ham_dpf_circuit(options, backend, circuit.shared_hashes, local_gates);
+  circuit.ham_dpf_circuit.window_offset = circuit.window_offset;
+  make_result_outputs(options, backend, circuit.ham_dpf_circuit, circuit.count_bits, local_gates);
+  timings.add("build_ham_dpf", clock::now() - build_start);
 }
 
-
-
-
-void print_stats(const Options& options,
-                 const MOTION::Statistics::AccumulatedRunTimeStats& run_time_stats,
-                 const MOTION::Statistics::AccumulatedCommunicationStats& comm_stats) {
-  if (options.json) {
-    auto obj = MOTION::Statistics::to_json("exact_pm", run_time_stats, comm_stats);
-    obj.emplace("party_id", options.my_id);
-    obj.emplace("threads", options.threads);
-    obj.emplace("sync_between_setup_and_online", options.sync_between_setup_and_online);
-    std::cout << obj << "\n";
-  } else {
-    std::cout << MOTION::Statistics::print_stats("Exact Pattern Matching", run_time_stats,
-                                                 comm_stats);
+// Register the host-side work of one chunk with the runner of its backend run
+template <typename T>
+void add_exact_pm_local_gates(ExactPMCircuit<T>& circuit, LocalGateRunner& local_gates, StageTimings& timings) {
+  using clock = StageTimings::clock;
+
+  if (circuit.options.match_mode == MatchMode::rolling) {
+    // ---------- LOCAL FINGERPRINT: Phase 1 shares -> shares of f ----------
+    local_gates.add([&circuit, &timings, &local_gates] {
+      local_gates.wait_online(circuit.rolling.pattern_wires);
+      local_gates.wait_online(circuit.rolling.text_wires);
+      auto fingerprint_start = clock::now();
+      compute_rolling_fingerprints(circuit.options, circuit.rolling);
+      timings.add("local_fingerprint", clock::now() - fingerprint_start);
+      circuit.rolling.fingerprints->set_online_ready();
+    }, [&circuit] {
+      circuit.rolling.fingerprints->get_share().assign(circuit.rolling.num_lanes, 0);
+      circuit.rolling.fingerprints->set_online_ready();
+    });
+
+    // ---------- ONLINE STAGE TIMERS ----------
+    local_gates.add([&circuit, &timings, &local_gates] {
+      auto mark = clock::now();
+      auto lap = [&](const char* stage) {
+        auto now = clock::now();
+        timings.add(stage, now - mark);
+        mark = now;
+      };
+      local_gates.wait_online(circuit.rolling.pattern_wires);
+      local_gates.wait_online(circuit.rolling.text_wires);
+      lap("online_input_sharing");
+      local_gates.wait_online(MOTION::NewWireP(circuit.rolling.fingerprints));
+      lap("online_local_fingerprint");
+      local_gates.wait_online(circuit.ham_dpf_circuit.ham_outputs);
+      lap("online_ham");
+      local_gates.wait_online(circuit.ham_dpf_circuit.dpf_outputs);
+      lap("online_dpf");
+    });
+    return;
   }
-}
-
 
+  // ---------- LOCAL HASH: Phase 1 shares -> Phase 2 input promises ----------
+  circuit.local_hash_finished = circuit.local_hash_done.get_future();
+  local_gates.add([&circuit, &timings, &local_gates] {
+    local_gates.wait_online(shared_input_wires(circuit.options, circuit.shared_data));
+    auto hash_start = clock::now();
+    compute_difference_concat_hash(circuit.options, circuit.shared_data, *circuit.workspace);
+    timings.add("local_difference_hash", clock::now() - hash_start);
+
+    // Set input for promises (one word plane of all window hashes per promise)
+    auto& promises = circuit.shared_hashes.my_hash_promises;
+    for (size_t w = 0; w < promises.size(); ++w) {
+      promises[w].set_value(StringProcessing::hash_word_plane<T>(circuit.workspace->hashes, w, circuit.options.threads));
+      circuit.hash_planes_provided = w + 1;
+    }
+    circuit.local_hash_done.set_value();
+  }, [&circuit] {
+    // Phase 2 still expects every plane: the missing ones go in as zeros
+    auto& promises = circuit.shared_hashes.my_hash_promises;
+    for (size_t w = circuit.hash_planes_provided; w < promises.size(); ++w) {
+      promises[w].set_value(std::vector<T>(circuit.shared_hashes.num_lanes, 0));
+    }
+    circuit.local_hash_done.set_exception(std::make_exception_ptr(std::runtime_error("local hash failed")));
+  });
+
+  // ---------- ONLINE STAGE TIMERS ----------
+  // The stages form one dependency chain, so each one is timed from the end of the previous one
+  // to the point where all of its output wires are online
+  local_gates.add([&circuit, &timings, &local_gates] {
+    auto mark = clock::now();
+    auto lap = [&](const char* stage) {
+      auto now = clock::now();
+      timings.add(stage, now - mark);
+      mark = now;
+    };
+    local_gates.wait_online(shared_input_wires(circuit.options, circuit.shared_data));
+    lap("online_input_sharing");
+    circuit.local_hash_finished.get();
+    lap("online_local_difference_hash");
+    local_gates.wait_online(circuit.shared_hashes.my_hash_wires);
+    local_gates.wait_online(circuit.shared_hashes.other_hash_wires);
+    lap("online_hash_sharing");
+    local_gates.wait_online(circuit.ham_dpf_circuit.ham_outputs);
+    lap("online_ham");
+    local_gates.wait_online(circuit.ham_dpf_circuit.dpf_outputs);
+    lap("online_dpf");
+    local_gates.wait_online(circuit.ham_dpf_circuit.final_results);
+    lap("online_and_combiner");
+  });
+}
 
-struct SecretShareHash {
-    // Each window gets one hash to secret share
-    std::vector<std::vector<MOTION::WireVector>> my_hash_wires;  
-    std::vector<std::vector<ENCRYPTO::ReusableFiberPromise<MOTION::IntegerValues<uint8_t>>>> my_hash_promises;
-    
-    // For receiving other party's hash shares
-    std::vector<std::vector<MOTION::WireVector>> other_hash_wires;
-};
+// --result-mode any / count over all chunks of a query
+// The chunk aggregates stay shared and are combined in the circuit, an OR tree for any and a local
+// sum for count, so only one value per pattern is revealed for the whole query: chunking does not
+// tell which chunk matched or how the matches are spread. A query spanning several backend runs
+// carries this party's share of the aggregate so far into the next run as a wire that is online
+// from the start (XOR and additive shares stay valid without interaction); the last run reveals it
+class QueryResultAggregate {
+ public:
+  QueryResultAggregate(const Options& options, std::size_t total_windows)
+      : mode_(options.result_mode), count_bits_(count_word_bits(total_windows)) {
+    summary_.num_patterns = options.num_patterns;
+    summary_.num_windows = total_windows;
+    summary_.outputs.mode = mode_;
+  }
 
-struct HAMDPFCircuit {
-    // HAM output wires (Hamming distances for each byte of each hash pair)
-    std::vector<std::vector<MOTION::WireVector>> ham_outputs;  // [hash_pair][byte_pos]
-    
-    // DPF output wires (equality check results for each byte of each hash pair)  
-    std::vector<std::vector<MOTION::WireVector>> dpf_outputs;  // [hash_pair][byte_pos]
-    
-    // Final results: one wire per hash pair indicating if hashes are equal
-    std::vector<MOTION::WireVector> final_results;  // [hash_pair]
-};
+  bool active() const { return revealed_per_query(mode_); }
+  std::size_t count_bits() const { return count_bits_; }
 
+  // Combine the aggregates of this run's chunks (and the carry of earlier runs); the last run
+  // reveals the result, earlier ones keep it shared
+  void build(const Options& options, MOTION::TwoPartyBackend& backend, std::vector<MOTION::WireVector> aggregates,
+             bool last_run, LocalGateRunner& local_gates) {
+    if (!active()) {
+      return;
+    }
+    auto& gate_factory = backend.get_gate_factory(options.boolean_protocol);
+    std::size_t groups = summary_.num_patterns;
+    if (mode_ == ResultMode::any) {
+      if (has_carry_) {
+        auto carry = std::make_shared<BooleanGMWWire>(groups);
+        carry->get_share() = any_carry_;
+        carry->set_online_ready();
+        aggregates.push_back({carry});
+      }
+      combined_ = make_tree_reduction(gate_factory, ENCRYPTO::PrimitiveOperationType::OR, std::move(aggregates));
+      if (last_run) {
+        summary_.outputs.bits = gate_factory.make_boolean_output_gate_my(MOTION::ALL_PARTIES, combined_);
+      }
+      return;
+    }
+    switch (count_bits_) {
+      case 8: build_count<uint8_t>(gate_factory, std::move(aggregates), last_run, local_gates); break;
+      case 16: build_count<uint16_t>(gate_factory, std::move(aggregates), last_run, local_gates); break;
+      case 32: build_count<uint32_t>(gate_factory, std::move(aggregates), last_run, local_gates); break;
+      default: build_count<uint64_t>(gate_factory, std::move(aggregates), last_run, local_gates); break;
+    }
+  }
 
-auto create_hash_ss_circuit_inputs(const Options& options, MOTION::TwoPartyBackend& backend, std::vector<std::vector<uint8_t>>& hashes) {
-  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
-  
-  SecretShareHash shared_hash;
-  size_t number_of_hashes = hashes.size();
-  
-  shared_hash.my_hash_wires.resize(number_of_hashes);
-  shared_hash.my_hash_promises.resize(number_of_hashes);
-  shared_hash.other_hash_wires.resize(number_of_hashes);
-
-  for (size_t hash_no = 0; hash_no < number_of_hashes; ++hash_no) {
-    size_t hash_size = hashes[hash_no].size();
-    shared_hash.my_hash_wires[hash_no].resize(hash_size);
-    shared_hash.my_hash_promises[hash_no].resize(hash_size);
-    shared_hash.other_hash_wires[hash_no].resize(hash_size);
-    
-    for (size_t j = 0; j < hash_size; ++j) {
-      // COMPLEMENTARY GATE ORDER based on party ID
-      if (options.my_id == 0) {
-        // Party 0: Create send gate first, then receive gate
-        auto pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
-        shared_hash.my_hash_promises[hash_no][j] = std::move(pair.first);
-        shared_hash.my_hash_wires[hash_no][j] = std::move(pair.second);
-        
-        shared_hash.other_hash_wires[hash_no][j] = gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1);
+  // After a run: keep this party's share for the next run, or print the revealed result
+  void finish_run(const Options& options, bool last_run) {
+    if (!active()) {
+      return;
+    }
+    if (last_run) {
+      if (options.json) {
+        print_match_results_json(options, summary_);
       } else {
-        // Party 1: Create receive gate first, then send gate  
-        shared_hash.other_hash_wires[hash_no][j] = gate_factory.make_arithmetic_8_input_gate_other(1 - options.my_id, 1);
-        
-        auto pair = gate_factory.make_arithmetic_8_input_gate_my(options.my_id, 1);
-        shared_hash.my_hash_promises[hash_no][j] = std::move(pair.first);
-        shared_hash.my_hash_wires[hash_no][j] = std::move(pair.second);
+        print_ham_dpf_results(options, summary_);
       }
+      return;
+    }
+    has_carry_ = true;
+    if (mode_ == ResultMode::any) {
+      any_carry_ = std::static_pointer_cast<BooleanGMWWire>(combined_.at(0))->get_share();
+      return;
+    }
+    switch (count_bits_) {
+      case 8: carry_counts<uint8_t>(); break;
+      case 16: carry_counts<uint16_t>(); break;
+      case 32: carry_counts<uint32_t>(); break;
+      default: carry_counts<uint64_t>(); break;
     }
   }
 
-  return shared_hash;
-}
-
-
-void print_secret_shared_hash_details(const Options& options, const SecretShareHash& shared_hash, const std::vector<std::vector<uint8_t>>& original_hashes) {
-  std::cout << "\n=== HASH SECRET SHARING DETAILS ===" << std::endl;
-  size_t number_of_hashes = original_hashes.size();
+ private:
+  template <typename C>
+  void build_count(MOTION::GateFactory& gate_factory, std::vector<MOTION::WireVector> aggregates, bool last_run,
+                   LocalGateRunner& local_gates) {
+    std::size_t groups = summary_.num_patterns;
+    if (has_carry_) {
+      auto carry = std::make_shared<ArithmeticGMWWire<C>>(groups);
+      carry->get_share().assign(count_carry_.begin(), count_carry_.end());
+      carry->set_online_ready();
+      aggregates.push_back({carry});
+    }
+    combined_ = make_count_sum<C>(aggregates, groups, local_gates);
+    if (last_run) {
+      summary_.outputs.counts = make_count_output<C>(gate_factory, combined_);
+    }
+  }
 
-  for (size_t hash_no = 0; hash_no < number_of_hashes; ++hash_no) {
-    std::cout << "Hash " << hash_no << ":" << std::endl;
-    size_t hash_size = original_hashes[hash_no].size();
+  template <typename C>
+  void carry_counts() {
+    const auto& shares = std::static_pointer_cast<ArithmeticGMWWire<C>>(combined_.at(0))->get_share();
+    count_carry_.assign(shares.begin(), shares.end());
+  }
 
-    for (size_t byte_pos = 0; byte_pos < hash_size; ++byte_pos) {
-      auto gmw_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_hash.my_hash_wires[hash_no][byte_pos][0]);
-      auto share_values = gmw_wire->get_share();
+  ResultMode mode_;
+  std::size_t count_bits_;
+  HAMDPFCircuit summary_;  // the query as one chunk of all windows, carries the output gates
+  MOTION::WireVector combined_;
+  bool has_carry_ = false;
+  ENCRYPTO::BitVector<> any_carry_;
+  std::vector<std::uint64_t> count_carry_;
+};
 
-      auto gmw_other_wire = std::static_pointer_cast<ArithmeticGMWWire<uint8_t>>(shared_hash.other_hash_wires[hash_no][byte_pos][0]);
-      auto received_values = gmw_other_wire->get_share();
+// ---------- AFTER RUN: PRINT RESULTS / DEBUG ----------
+template <typename T>
+void print_exact_pm_results(ExactPMCircuit<T>& circuit) {
+  const Options& options = circuit.options;
+  // any / count are revealed once per query, by QueryResultAggregate::finish_run
+  bool chunk_results = !revealed_per_query(options.result_mode);
+  if (options.json) {
+    if (chunk_results) {
+      print_match_results_json(options, circuit.ham_dpf_circuit);
+    }
+    return;
+  }
 
-      uint8_t original_byte = original_hashes[hash_no][byte_pos];
-      uint8_t my_share = share_values[0];
-      uint8_t sent_share = original_byte - my_share;
-      uint8_t received_share = received_values[0];
-      
-      
-      std::cout << "  Byte[" << byte_pos << "] = " << (int)original_byte << ": \n";
-      std::cout << "\tMy share = " << (int)my_share << '\n'
-                << "\tSent share = " << (int)sent_share << '\n'
-                << "\tReceived share = " << (int)received_share << std::endl;
+  if (!options.verbose) {
+    if (chunk_results) {
+      print_ham_dpf_results(options, circuit.ham_dpf_circuit);
     }
+    return;
   }
-}
 
+  // --verbose: the shares and hashes of every window before the results
+  if (options.match_mode == MatchMode::rolling) {
+    std::cout << "\n=== Fingerprint shares (" << 8 * sizeof(T) << "-bit ring) ===" << std::endl;
+    auto fingerprints = ShareKernels::get_share_span<T>(MOTION::WireVector{circuit.rolling.fingerprints});
+    size_t num_windows = circuit.ham_dpf_circuit.num_windows;
+    for (size_t lane = 0; lane < fingerprints.size; ++lane) {
+      std::cout << "  Fingerprint ";
+      if (options.num_patterns > 1) {
+        std::cout << "P" << lane / num_windows + 1 << " ";
+      }
+      std::cout << circuit.window_offset + lane % num_windows << ": " << (uint64_t)fingerprints[lane] << std::endl;
+    }
+    if (chunk_results) {
+      print_ham_dpf_results(options, circuit.ham_dpf_circuit);
+    }
+    return;
+  }
 
-void run_secret_share_hashes_circuit(const Options& options, MOTION::TwoPartyBackend& backend, const SecretShareHash& shared_hash, const std::vector<std::vector<uint8_t>>& original_hashes) {
+  // Phase 1: character shares and window hashes
+  const auto& hashes = circuit.workspace->hashes;
+  print_pattern_text_circuit_summary(options, circuit.shared_data, &circuit.workspace->pattern_values,
+                                     &circuit.text_windows);
 
-  if (options.no_run) {
-    return;
+  std::cout << "\n\n\n=== All Hashes ===" << std::endl;
+  size_t num_windows = options.text_size - options.pattern_size + 1;
+  for (size_t lane = 0; lane < hashes.size(); ++lane) {
+    std::cout << "  Hash ";
+    if (options.num_patterns > 1) {
+      std::cout << "P" << lane / num_windows + 1 << " ";
+    }
+    std::cout << circuit.window_offset + lane % num_windows << ": "
+              << StringProcessing::concat_vector(hashes[lane]) << std::endl;
   }
 
-  // Execute the circuit to complete the secret sharing process
-  backend.run();
+  // Phase 2: hash shares
+  print_secret_shared_hash_details(options, circuit.shared_hashes, hashes);
 
-  if (!options.json) {
-    print_secret_shared_hash_details(options, shared_hash, original_hashes);
+  // Phase 3: Print HAM+DPF
+  if (chunk_results) {
+    print_ham_dpf_results(options, circuit.ham_dpf_circuit);
   }
 }
 
-HAMDPFCircuit create_ham_dpf_circuit(const Options& options, MOTION::TwoPartyBackend& backend, const SecretShareHash& shared_hash) {
-  auto& gate_factory = backend.get_gate_factory(options.arithmetic_protocol);
-  
-  HAMDPFCircuit ham_dpf_circuit;
-  size_t num_hashes = shared_hash.my_hash_wires.size();
-  size_t hash_size = 32;  // 256-bit hash = 32 bytes
-  
-  std::cout << "\n=== Creating HAM+DPF Circuit for " << num_hashes << " hash pairs ===" << std::endl;
-  
-  // Initialize circuit structures
-  ham_dpf_circuit.ham_outputs.resize(num_hashes);
-  ham_dpf_circuit.dpf_outputs.resize(num_hashes);
-  ham_dpf_circuit.final_results.resize(num_hashes);
-  
-  // Process each hash pair (pairwise comparison: h0==h0', h1==h1', etc.)
-  for (size_t hash_no = 0; hash_no < num_hashes; ++hash_no) {
-    std::cout << "Processing hash pair " << hash_no << ":" << std::endl;
-    
-    ham_dpf_circuit.ham_outputs[hash_no].resize(hash_size);
-    ham_dpf_circuit.dpf_outputs[hash_no].resize(hash_size);
-    
-    // For each byte in the hash
-    for (size_t byte_pos = 0; byte_pos < hash_size; ++byte_pos) {
-      
-      // Step 2: Calculate difference SS(h0) - SS(h1) using NEG + ADD gates
-      // NEG gate: -SS(h1) 
-      auto neg_other_hash = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::NEG, 
-                                                         shared_hash.other_hash_wires[hash_no][byte_pos]);
-      
-      // ADD gate: SS(h0) + (-SS(h1)) = SS(h0 - h1)
-      auto hash_difference = gate_factory.make_binary_gate(ENCRYPTO::PrimitiveOperationType::ADD,
-                                                          shared_hash.my_hash_wires[hash_no][byte_pos],
-                                                          neg_other_hash);
-      
-      // Steps 3-5: HAM gate (generates random mask, publishes a+r, computes Hamming distance)
-      auto hamming_distance = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::HAM, 
-                                                          hash_difference);
-      ham_dpf_circuit.ham_outputs[hash_no][byte_pos] = hamming_distance;
-      
-      // Step 6: DPF gate (equality check: HD==0?)
-      auto is_equal = gate_factory.make_unary_gate(ENCRYPTO::PrimitiveOperationType::DPF,
-                                                  hamming_distance);
-      ham_dpf_circuit.dpf_outputs[hash_no][byte_pos] = is_equal;
-      
-      // std::cout << "  Byte " << byte_pos << ": NEG -> ADD -> HAM -> DPF" << std::endl;
+// One repetition of a query, on fresh backends over the shared connection
+// Without --chunk-windows all windows form one chunk in one backend run. Otherwise the windows
+// are split into chunks of chunk_windows (the text slices overlap by pattern_size - 1 characters)
+// and each backend run builds chunks_in_flight of them, so the input sharing of one chunk overlaps
+// the HAM/DPF evaluation of the one before it while memory stays bounded by the chunks in a run
+template <typename T>
+void run_exact_pm_pipeline(const Options& options, MOTION::Communication::CommunicationLayer& comm_layer,
+                           std::shared_ptr<MOTION::Logger> logger, WorkspacePool& workspaces,
+                           MOTION::Statistics::AccumulatedRunTimeStats& run_time_stats, StageTimings& timings) {
+  std::size_t total_windows = options.text_size - options.pattern_size + 1;
+  std::size_t chunk_windows = chunk_window_count(options);
+  std::size_t windows_per_run = chunk_windows * options.chunks_in_flight;
+
+  // Chunks copy the options without the text and slice their part of it
+  Options chunk_base = options;
+  chunk_base.text.clear();
+  chunk_base.text.shrink_to_fit();
+
+  QueryResultAggregate query_result(options, total_windows);
+  for (std::size_t run_offset = 0; run_offset < total_windows; run_offset += windows_per_run) {
+    if (run_offset > 0) {
+      comm_layer.sync();
     }
-    
-    // Combine all byte equality results for this hash pair using AND gates
-    // All bytes must be equal for the hashes to be equal
-    auto combined_result = ham_dpf_circuit.dpf_outputs[hash_no][0];  // Start with first byte
-    
-    for (size_t byte_pos = 1; byte_pos < hash_size; ++byte_pos) {
-      combined_result = gate_factory.make_binary_gate(ENCRYPTO::PrimitiveOperationType::AND,
-                                                     combined_result,
-                                                     ham_dpf_circuit.dpf_outputs[hash_no][byte_pos]);
+    // MOTION's TwoPartyBackend has no reset, so every run pays the full per-run setup (gate and wire
+    // allocation, base OTs, triples); only the connection and the chunk workspaces carry over
+    MOTION::TwoPartyBackend backend(comm_layer, options.threads, options.sync_between_setup_and_online, logger);
+
+    // Registered during the build (result aggregation) and before the run (local hash, timers)
+    LocalGateRunner local_gates;
+    std::vector<std::unique_ptr<ExactPMCircuit<T>>> circuits;
+    std::size_t run_end = std::min(run_offset + windows_per_run, total_windows);
+    for (std::size_t offset = run_offset; offset < run_end; offset += chunk_windows) {
+      auto circuit = std::make_unique<ExactPMCircuit<T>>();
+      circuit->options =
+          make_chunk_options(chunk_base, options.text, offset, std::min(chunk_windows, run_end - offset));
+      circuit->window_offset = offset;
+      circuit->count_bits = query_result.count_bits();
+      circuit->workspace = workspaces.acquire();
+      build_exact_pm_circuit(*circuit, backend, local_gates, timings);
+      circuits.push_back(std::move(circuit));
     }
-    
-    ham_dpf_circuit.final_results[hash_no] = combined_result;
-    std::cout << "  Final result: AND of all " << hash_size << " byte equality checks" << std::endl;
-  }
-  
-  std::cout << "HAM+DPF circuit creation complete!" << std::endl;
-  return ham_dpf_circuit;
-}
+    bool last_run = run_end == total_windows;
+    std::vector<MOTION::WireVector> aggregates;
+    for (auto& circuit : circuits) {
+      aggregates.push_back(circuit->ham_dpf_circuit.aggregate);
+    }
+    query_result.build(options, backend, std::move(aggregates), last_run, local_gates);
 
-void run_ham_dpf_circuit(const Options& options, MOTION::TwoPartyBackend& backend, const HAMDPFCircuit& ham_dpf_circuit) {
-  if (options.no_run) {
-    return;
-  }
+    if (!options.no_run) {
+      // ---------- Run all 3 PHASES of all chunks in flight (run backend one time) ----------
+      for (auto& circuit : circuits) {
+        add_exact_pm_local_gates(*circuit, local_gates, timings);
+      }
+      local_gates.run(backend);
 
-  std::cout << "\n=== Executing HAM+DPF Circuit ===" << std::endl;
-  
-  // Execute the HAM+DPF circuit
-  backend.run();
-  
-  if (!options.json) {
-    std::cout << "\n=== HAM+DPF Results ===" << std::endl;
-    
-    // Display results for each hash pair
-    for (size_t hash_no = 0; hash_no < ham_dpf_circuit.final_results.size(); ++hash_no) {
-      // Extract the final equality result
-      auto result_wire = std::static_pointer_cast<BooleanGMWWire>(ham_dpf_circuit.final_results[hash_no][0]);
-      auto result_bits = result_wire->get_share();
-      
-      bool is_equal = result_bits.Get(0);  // Get the boolean result
-      
-      std::cout << "Hash pair " << hash_no << ": " 
-                << (is_equal ? "EQUAL ✓" : "NOT EQUAL ✗") << std::endl;
-    }
-    
-    // Overall pattern matching result
-    bool pattern_found = false;
-    for (size_t hash_no = 0; hash_no < ham_dpf_circuit.final_results.size(); ++hash_no) {
-      auto result_wire = std::static_pointer_cast<BooleanGMWWire>(ham_dpf_circuit.final_results[hash_no][0]);
-      auto result_bits = result_wire->get_share();
-      
-      if (result_bits.Get(0)) {
-        pattern_found = true;
-        break;
+      for (auto& circuit : circuits) {
+        print_exact_pm_results(*circuit);
       }
+      query_result.finish_run(options, last_run);
     }
-    
-    std::cout << "\n🎯 FINAL PATTERN MATCHING RESULT: " 
-              << (pattern_found ? "PATTERN FOUND! 🎉" : "PATTERN NOT FOUND 😞") << std::endl;
+    for (auto& circuit : circuits) {
+      workspaces.release(std::move(circuit->workspace));
+    }
+    run_time_stats.add(backend.get_run_time_stats());
   }
 }
 
 
-auto make_dpf_in_wire(const Options& options) {
-  
-  auto num_simd = (options.text_size - options.pattern_size + 1);
-  auto num_wires = options.pattern_size;
-
-  auto wire = std::make_shared<ArithmeticGMWWire<uint8_t>>(num_simd);
-  std::vector<MOTION::NewWireP> in;
-  std::vector<uint8_t> x(num_simd, 2*num_wires);
-
-  wire->get_share() = x;
-  wire->set_online_ready();
-
-  in.push_back(wire);
-  return in;
-}
+// Run one query: all repetitions over the already established connection
+// Only the connection and the host-side chunk buffers (`workspaces`) outlive a backend run; MOTION's
+// backend cannot be reset, so each run still builds a fresh one and repeats its base OT and
+// preprocessing setup
+void run_query(const Options& options, CommunicationSession& session, std::shared_ptr<MOTION::Logger> logger,
+               WorkspacePool& workspaces) {
+  auto& comm_layer = *session.comm_layer;
+  MOTION::Statistics::AccumulatedRunTimeStats run_time_stats;
+  MOTION::Statistics::AccumulatedCommunicationStats comm_stats;
+  SessionStatistics session_stats;
+  {
+    SessionStatistics earlier;
+    session.take_statistics(earlier);  // drop the traffic of earlier queries
+  }
+  StageTimings stage_timings;
 
-auto make_ham_in_wire(const Options& options) {
-  
-  auto num_simd = (options.text_size - options.pattern_size + 1);
+  for (std::size_t rep = 0; rep < options.num_repetitions; ++rep) {
+    auto wall_start = StageTimings::clock::now();
+    auto cpu_start = process_cpu_time();
 
-  auto wire = std::make_shared<ArithmeticGMWWire<uint32_t>>(num_simd);
-  std::vector<MOTION::NewWireP> in;
-  std::vector<uint32_t> x(num_simd, 1);
+    switch (compare_word_bits(options)) {
+      case 8: run_exact_pm_pipeline<uint8_t>(options, comm_layer, logger, workspaces, run_time_stats, stage_timings); break;
+      case 16: run_exact_pm_pipeline<uint16_t>(options, comm_layer, logger, workspaces, run_time_stats, stage_timings); break;
+      case 32: run_exact_pm_pipeline<uint32_t>(options, comm_layer, logger, workspaces, run_time_stats, stage_timings); break;
+      default: run_exact_pm_pipeline<uint64_t>(options, comm_layer, logger, workspaces, run_time_stats, stage_timings); break;
+    }
 
-  wire->get_share() = x;
-  wire->set_online_ready();
+    comm_layer.sync();
+    comm_stats.add(comm_layer.get_transport_statistics());
+    comm_layer.reset_transport_statistics();
+    session.take_statistics(session_stats);
+    stage_timings.add("wall", StageTimings::clock::now() - wall_start);
+    stage_timings.add("cpu", process_cpu_time() - cpu_start);
+  }
 
-  in.push_back(wire);
-  return in;
+  print_stats(options, run_time_stats, comm_stats, stage_timings, session_stats);
 }
 
-
-void run_circuit(const Options& options, MOTION::TwoPartyBackend& backend, WireVector in1, WireVector in2) {
-
-  if (options.no_run) {
-    return;
+// A failed --service query: {"query_id": 3, "error": "..."} in place of its stats line with --json
+void print_query_error(const Options& options, const std::string& message) {
+  if (options.json) {
+    boost::json::object obj;
+    obj.emplace("query_id", options.query_id);
+    obj.emplace("error", message);
+    std::cout << obj << "\n";
+  } else {
+    std::cerr << "ERROR in query " << options.query_id << ": " << message << "\n";
   }
-
-  MOTION::MPCProtocol arithmetic_protocol = options.arithmetic_protocol;
-  MOTION::MPCProtocol boolean_protocol = options.boolean_protocol;
-  auto& gate_factory_arith = backend.get_gate_factory(arithmetic_protocol);
-  auto& gate_factory_bool = backend.get_gate_factory(boolean_protocol);
-
-  auto output1 = gate_factory_bool.make_unary_gate(ENCRYPTO::PrimitiveOperationType::HAM, in1);
-  auto output = gate_factory_arith.make_unary_gate(
-    ENCRYPTO::PrimitiveOperationType::DPF, in2);
-  
-  backend.run();
-
 }
 
-
-void print_ham_dpf_results(const Options& options, const HAMDPFCircuit& ham_dpf_circuit) {
-  if (options.no_run || options.json) {
-    return;
+// Parse one descriptor line, e.g. "--pattern abc --text-size 64", on top of the service options
+std::optional<Options> parse_query_descriptor(const Options& service_options,
+                                              const std::string& line) {
+  Options options = service_options;
+  po::variables_map vm;
+  try {
+    auto args = po::split_unix(line);
+    po::store(po::command_line_parser(args).options(query_options_description()).run(), vm);
+    po::notify(vm);
+  } catch (std::exception& e) {
+    std::cerr << "error in query descriptor: " << e.what() << "\n";
+    return std::nullopt;
   }
+  if (!parse_query_inputs(options, vm)) {
+    return std::nullopt;
+  }
+  return options;
+}
 
-  std::cout << "\n=== HAM+DPF Results ===" << std::endl;
-
-  // Display results for each hash pair
-  for (size_t hash_no = 0; hash_no < ham_dpf_circuit.final_results.size(); ++hash_no) {
-    auto result_wire = std::static_pointer_cast<BooleanGMWWire>(ham_dpf_circuit.final_results[hash_no][0]);
-    auto result_bits = result_wire->get_share();
-
-    bool is_equal = result_bits.Get(0);
-
-    std::cout << "Hash pair " << hash_no << ": "
-              << (is_equal ? "EQUAL(666)" : "NOT EQUAL(die)") << std::endl;
+// Raw text bytes a descriptor announces with --text-bytes N (0 if none or unreadable), so that the
+// text after a rejected descriptor can be skipped
+std::size_t announced_text_bytes(const std::string& line) {
+  try {
+    auto args = po::split_unix(line);
+    for (std::size_t i = 0; i < args.size(); ++i) {
+      if (args[i] == "--text-bytes" && i + 1 < args.size()) {
+        return boost::lexical_cast<std::size_t>(args[i + 1]);
+      }
+      if (boost::algorithm::starts_with(args[i], "--text-bytes=")) {
+        return boost::lexical_cast<std::size_t>(args[i].substr(std::string("--text-bytes=").size()));
+      }
+    }
+  } catch (std::exception&) {
   }
+  return 0;
+}
 
-  bool pattern_found = false;
-  for (size_t hash_no = 0; hash_no < ham_dpf_circuit.final_results.size(); ++hash_no) {
-    auto result_wire = std::static_pointer_cast<BooleanGMWWire>(ham_dpf_circuit.final_results[hash_no][0]);
-    auto result_bits = result_wire->get_share();
-    if (result_bits.Get(0)) {
-      pattern_found = true;
+// Serve queries until EOF or "quit" on the control channel.  Both parties have to
+// read the same sequence of descriptors (with their own role-specific inputs).
+// A text holder descriptor with --text-bytes N is followed by exactly N raw text bytes, so a
+// driver can pipe uploaded text into a long-lived service without writing it to disk.
+// An invalid descriptor fails its query only: its text (if announced) is skipped and an error
+// line is printed in place of the stats line.
+// The service saves the connection setup per query; the backend setup is still paid per run.
+void run_service(const Options& options, CommunicationSession& session, std::shared_ptr<MOTION::Logger> logger,
+                 WorkspacePool& workspaces) {
+  std::ifstream control_file;
+  if (options.control != "-") {
+    control_file.open(options.control);
+    if (!control_file) {
+      throw std::runtime_error("cannot open control channel " + options.control);
+    }
+  }
+  std::istream& control = options.control == "-" ? std::cin : control_file;
+
+  std::size_t query_id = 0;
+  std::string line;
+  while (std::getline(control, line)) {
+    boost::algorithm::trim(line);
+    if (line.empty()) {
+      continue;
+    }
+    if (line == "quit") {
       break;
     }
+    auto query = parse_query_descriptor(options, line);
+    if (!query.has_value()) {
+      control.ignore(static_cast<std::streamsize>(announced_text_bytes(line)));
+      Options rejected = options;
+      rejected.query_id = query_id++;
+      print_query_error(rejected, "invalid query descriptor: " + line);
+      std::cout.flush();
+      continue;
+    }
+    if (query->text_follows) {
+      query->text.resize(query->text_size);
+      control.read(query->text.data(), static_cast<std::streamsize>(query->text_size));
+      if (static_cast<std::size_t>(control.gcount()) != query->text_size) {
+        throw std::runtime_error("control channel closed inside the text of query " + std::to_string(query_id));
+      }
+    }
+    query->query_id = query_id++;
+    try {
+      run_query(*query, session, logger, workspaces);
+    } catch (const std::runtime_error& e) {
+      // Only this query fails, the service goes on with the next descriptor
+      print_query_error(*query, e.what());
+    }
+    std::cout.flush();  // the driver reads the query's lines as they complete
   }
-
-  std::cout << "\n🎯 FINAL PATTERN MATCHING RESULT: "
-            << (pattern_found ? "PATTERN FOUND! 🎉" : "PATTERN NOT FOUND 😞") << std::endl;
 }
 
-
 int main(int argc, char* argv[]) {
   auto options = parse_program_options(argc, argv);
-  std::vector<std::vector<uint8_t>> hashes;
   
   if (!options.has_value()) {
     return EXIT_FAILURE;
   }
-  
-  // ========== PHASE 1: CHARACTER SECRET SHARING ==========
-  try {
-    auto comm_layer = setup_communication(*options);
-    auto logger = std::make_shared<MOTION::Logger>(options->my_id,
-                                                   boost::log::trivial::severity_level::trace);
-    comm_layer->set_logger(logger);
-    MOTION::Statistics::AccumulatedRunTimeStats run_time_stats;
-    MOTION::Statistics::AccumulatedCommunicationStats comm_stats;
-    
-    for (std::size_t i = 0; i < options->num_repetitions; ++i) {
-      MOTION::TwoPartyBackend backend(*comm_layer, options->threads,
-                                      options->sync_between_setup_and_online, logger);
-
-      // Character sharing logic (unchanged)
-      auto shared_data = create_circuit_inputs(*options, backend);
-      
-      // Provide actual input values based on role using individual character sharing
-      std::vector<uint8_t> pattern_values;
-      std::vector<std::vector<uint8_t>> text_values;
-      
-      
-      if (options->role == "pattern_holder") {
-        // PATTERN HOLDER: Process and provide pattern characters for secret sharing
-        pattern_values = StringProcessing::pattern_holder(options->pattern);
-        
-        // PROMISE FULFILLMENT: Feed actual ASCII values into the secret sharing mechanism
-        // Each promise.set_value() triggers the generation of secret shares
-        for (size_t i = 0; i < pattern_values.size(); ++i) {
-          // Wrap single ASCII value in vector (SIMD size 1)
-          std::vector<uint8_t> single_char = {pattern_values[i]};
-          
-          // CRITICAL: This triggers secret sharing for character i
-          // The framework will:
-          // 1. Generate a random share for this party
-          // 2. Calculate and send complementary share to other party
-          // 3. Store this party's share in the corresponding wire
-          shared_data.pattern_char_promises[i].set_value(single_char);
-          
-          // Example: For 'H' (ASCII 72):
-          // - Framework generates random value: 123
-          // - Calculates sent share: 72 - 123 = 205 (mod 2^8)  
-          // - Stores 123 in pattern_char_wires[i]
-          // - Sends 205 to text holder
-        }
-        
-        // Run the circuit with pattern values
-        hashes = run_pattern_text_circuit(*options, backend, shared_data, &pattern_values, nullptr);
-        
-      } else if (options->role == "text_holder") {
-        // TEXT HOLDER: Process and provide text characters for secret sharing
-        text_values = StringProcessing::text_holder(options->text, options->pattern_size);
-        
-        // PROMISE FULFILLMENT: Feed actual ASCII values for each character in each window
-        for (size_t window = 0; window < text_values.size(); ++window) {
-          for (size_t pos = 0; pos < text_values[window].size(); ++pos) {
-            // Wrap single ASCII value in vector (SIMD size 1)
-            std::vector<uint8_t> single_char = {text_values[window][pos]};
-            
-            // CRITICAL: This triggers secret sharing for this window position
-            // Same process as pattern holder but for text characters
-            shared_data.text_window_promises[window][pos].set_value(single_char);
-            
-            // Example: For 'E' (ASCII 69) in window 1, position 1:
-            // - Framework generates random value: 87
-            // - Calculates sent share: 69 - 87 = 238 (mod 2^8)
-            // - Stores 87 in text_window_wires[1][1]  
-            // - Sends 238 to pattern holder
-          }
-        }
-        
-        // Run the circuit with text values
-        hashes = run_pattern_text_circuit(*options, backend, shared_data, nullptr, &text_values);
-      }
-      
-      comm_layer->sync();
-      comm_stats.add(comm_layer->get_transport_statistics());
-      comm_layer->reset_transport_statistics();
-      run_time_stats.add(backend.get_run_time_stats());
-    }
-    
-    // CRITICAL: Proper cleanup of Phase 1
-    comm_layer->sync();                    // Final synchronization
-    comm_layer->shutdown();                // Shutdown connections
-    comm_layer.reset();                    // Release communication layer
-    
-    std::cout << "\n=== Phase 1 Complete - Character sharing finished ===\n" << std::endl;
-    print_stats(*options, run_time_stats, comm_stats);
-    
-  } catch (std::runtime_error& e) {
-    std::cerr << "ERROR in Phase 1: " << e.what() << "\n";
-    return EXIT_FAILURE;
-  }
-
-    // ========== PHASE TRANSITION ==========
-  std::cout << "\n=== Starting Phase 2 & 3 (shared backend) ===\n" << std::endl;
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
+  
+  // ========== ONE CONNECTION PER PROCESS, A FRESH BACKEND PER RUN ==========
   try {
-    auto comm_layer = setup_communication(*options);
+    auto session = setup_communication(*options);
+    auto& comm_layer = session.comm_layer;
     auto logger = std::make_shared<MOTION::Logger>(options->my_id,
                                                    boost::log::trivial::severity_level::trace);
     comm_layer->set_logger(logger);
-    MOTION::Statistics::AccumulatedRunTimeStats run_time_stats;
-    MOTION::Statistics::AccumulatedCommunicationStats comm_stats;
-
-    for (std::size_t rep = 0; rep < options->num_repetitions; ++rep) {
-      // Dùng CHUNG backend cho Phase 2 + Phase 3
-      MOTION::TwoPartyBackend backend(*comm_layer, options->threads,
-                                      options->sync_between_setup_and_online, logger);
-
-      // ---------- PHASE 2: HASH SECRET SHARING (build circuit & set input) ----------
-      std::cout << "\n=== Phase 2 - Hash secret sharing (build only) ===\n" << std::endl;
-
-      SecretShareHash shared_hashes = create_hash_ss_circuit_inputs(*options, backend, hashes);
-
-      // Set input for promises (hash bytes)
-      for (size_t h = 0; h < hashes.size(); ++h) {
-        for (size_t b = 0; b < hashes[h].size(); ++b) {
-          shared_hashes.my_hash_promises[h][b].set_value({hashes[h][b]});
-        }
-      }
 
-      // ---------- PHASE 3: HAM+DPF PATTERN MATCHING (build circuit) ----------
-      std::cout << "\n=== Phase 3 - HAM+DPF Pattern Matching (build only) ===\n" << std::endl;
-
-      HAMDPFCircuit ham_dpf_circuit = create_ham_dpf_circuit(*options, backend, shared_hashes);
-
-      // ---------- Run 2 PHASE (run backend one time) ----------
-      if (!options->no_run) {
-        backend.run();
-      }
-
-      // ---------- AFTER RUN: PRINT RESULTS / DEBUG ----------
-      if (!options->json && !options->no_run) {
-        // Phase 2: hash shares
-        print_secret_shared_hash_details(*options, shared_hashes, hashes);
-
-        // Phase 3: Print HAM+DPF
-        print_ham_dpf_results(*options, ham_dpf_circuit);
-      }
-
-      comm_layer->sync();
-      comm_stats.add(comm_layer->get_transport_statistics());
-      comm_layer->reset_transport_statistics();
-      run_time_stats.add(backend.get_run_time_stats());
+    WorkspacePool workspaces;
+    if (options->service) {
+      run_service(*options, session, logger, workspaces);
+    } else {
+      run_query(*options, session, logger, workspaces);
     }
 
     comm_layer->shutdown();
-    print_stats(*options, run_time_stats, comm_stats);
 
-    std::cout << "\n🎉 EXACT PATTERN MATCHING COMPLETE! 🎉" << std::endl;
+    if (!options->json) {
+      std::cout << "\n🎉 EXACT PATTERN MATCHING COMPLETE! 🎉" << std::endl;
+    }
 
   } catch (std::runtime_error& e) {
-    std::cerr << "ERROR in Phase 2/3: " << e.what() << "\n";
+    std::cerr << "ERROR: " << e.what() << "\n";
     return EXIT_FAILURE;
   }
 